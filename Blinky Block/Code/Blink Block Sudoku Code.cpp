@@ -5,63 +5,254 @@
 #include <serial.h>
 #include <layer3_generic.h>
 #include <light.h>
-#include <stdio.h>  // For printf
 #include <stdint.h> // For uint8_t, uint16_t, etc.
 #include <math.h> // For uint8_t, uint16_t, etc.
+#include <sudokuCore.h> // Protocol core shared with VisibleSim (Core/ on the include path)
 
-#define COLOR_MSG 1
-#define SETCOOR_MSG 2
-#define HORIZONTAL_MSG 3
-#define VERTICAL_MSG 4
-#define DIAL_MSG 5
-#define UPDATE_MSG 6
-#define ACK_MSG 7
+// This file is the BB.h adapter of the core: it maps the core's directions to ports,
+// owns the timers, the LED, flash and the outboxes, and runs the core's state machines.
+#define COLOR_MSG SC_COLOR_MSG
+#define SETCOOR_MSG SC_SETCOOR_MSG
+#define HORIZONTAL_MSG SC_HORIZONTAL_MSG
+#define VERTICAL_MSG SC_VERTICAL_MSG
+#define DIAL_MSG SC_DIAL_MSG
+#define UPDATE_MSG SC_UPDATE_MSG
+#define ACK_MSG SC_ACK_MSG
+#define CANCEL_MSG SC_CANCEL_MSG
+#define COOR_REQUEST_MSG SC_COOR_REQUEST_MSG
+#define COOR_INVALIDATE_MSG SC_COOR_INVALIDATE_MSG
+#define STATS_QUERY_MSG SC_STATS_QUERY_MSG
+#define STATS_REPORT_MSG SC_STATS_REPORT_MSG
+#define FRAME_MSG SC_FRAME_MSG
 
-uint32_t timeTreatment;
-uint8_t currentColor = WHITE;
+// Largest L3 payload, the capacity of a frame
+#ifndef L3_PAYLOAD_MAX
+#define L3_PAYLOAD_MAX 32
+#endif
+#define FRAME_HEADER_SIZE SC_FRAME_HEADER_SIZE
+
+// Telemetry: messages per port and message type (types above ACK_MSG share the last column),
+// and L3 packets per port apart, a frame being one packet carrying several messages
+#define NB_COUNTED_TYPES (ACK_MSG + 1)
+#define LATENCY_BUCKETS 8             // <16 ms, then one bucket per power of two, last one >= 1024 ms
+#define STATS_VALUES SC_STATS_VALUES  // Values carried by one STATS_REPORT_MSG
+#define STATS_SECTIONS (2 * NB_SERIAL_PORT + 8)
+#define L3_FRAMES NB_SERIAL_PORT      // In an L3 section: packets per port, then frames, then bytes
+#define L3_BYTES (NB_SERIAL_PORT + 1)
+#define COUNTER_MAX UINT16_MAX       // Counters stop there instead of wrapping
+#if L3_BYTES >= STATS_VALUES
+#error "An L3 stats section holds one value per port, the frames and the bytes"
+#endif
+
+// Box (dial) dimensions in blocks: 2x2 for a 4x4 grid, 3x3 for a 9x9 grid
+#ifndef BOX_WIDTH
+#define BOX_WIDTH 2
+#endif
+#ifndef BOX_HEIGHT
+#define BOX_HEIGHT 2
+#endif
+#define NO_HOPS 0xFF
+#define NO_PORT SC_NO_PORT
+
+// Colors are indexes 1..NB_COLORS, one per cell of a box: 4 on a 4x4 grid, 9 on a 9x9 grid
+#ifndef NB_COLORS
+#define NB_COLORS (BOX_WIDTH * BOX_HEIGHT)
+#endif
+#if NB_COLORS > 9
+#error "The LED can show at most 9 colors"
+#endif
+#define NO_COLOR SC_NO_VALUE
+#define COLOR_BIT(c) SC_VALUE_BIT(c)
+#define ALL_COLORS_MASK SC_ALL_VALUES(NB_COLORS)
+
+// Scheduler settings
+#define NB_TIMERS 8                   // One slot per callback (6 today), plus spares
+#define TIMER_FAULT_PERIOD 100        // ms between two phases of the fast red blink of a full timer table
+#define PORT_SAMPLE_PERIOD 100        // ms between two connectivity samples
+#define BLINK_PERIOD 500              // ms between two phases of a blinking color
+#define ROOT_ELECTION_DELAY 300       // ms a fresh corner block waits for coordinates before becoming the root
+#define COOR_RETRY_DELAY 200          // ms an invalidated block waits before accepting coordinates from anyone
+#define RESTORE_SETTLE_DELAY 500      // ms the ports must stay unchanged before a flash record is checked
+#define PERSIST_DELAY 1000            // ms of quiet before the state is written to flash
+
+// Flash page holding the persisted state records (last 2 KB page of a 128 KB part)
+#ifndef PERSIST_PAGE_ADDR
+#define PERSIST_PAGE_ADDR 0x0801F800
+#endif
+#ifndef PERSIST_PAGE_SIZE
+#define PERSIST_PAGE_SIZE 2048
+#endif
+#define PERSIST_MAGIC 0x5D0C
+#define PERSIST_SLOTS (PERSIST_PAGE_SIZE / sizeof(PersistedState))
+#ifndef LOW_POWER_IDLE
+#define LOW_POWER_IDLE 1              // Sleep until the next interrupt when there is nothing to do
+#endif
+
+// Events raised by handlers, processed once per BBloop pass
+#define EV_LED_DIRTY 0x01             // currentColor or the blink phase changed
+#define EV_COLOR_STATUS 0x02          // The candidate mask changed
+#define EV_TOPOLOGY 0x04              // A grid port got connected or disconnected
+#define EV_FLUSH 0x08                 // Some outboxes hold sub-messages to send
+
+#define PORT_BIT(p) SC_PORT_BIT(p)
+
+typedef void (*TimerCallback)(void);
+
+// One-shot timer; a callback re-arms itself to run periodically
+typedef struct {
+    uint32_t due;
+    TimerCallback callback;
+} Timer;
+
+Timer timers[NB_TIMERS];
+volatile uint8_t pendingEvents = 0;
+uint8_t portMask = 0;             // Grid ports connected at the last sample
+uint8_t currentColor = NO_COLOR;
+uint8_t blinkPhase = 0;
 int16_t x, y;                     // Coordinates of the current block
 uint8_t hasSetCoordinates = 0;    // Tracks if the block has updated coordinates
-uint8_t nbrWaitedAnswers = 0; // Reset the number of waited acknowledgments
-uint8_t myCount = 232;          // Start at the initiator block
-uint8_t parentPort = -1;
-uint8_t secondNbrResponse= 0;
-uint8_t firstNbrResponse= 1;
-uint8_t expectedColorsRemains =4;
-uint8_t canBeGreen=1, canBeBlue=1, canBeRed=1, canBeOrange=1;
+uint8_t coorHops = NO_HOPS;       // Distance to the coordinate root along the SETCOOR wave
+uint8_t gridEpoch = 0;            // Bumped each time the grid is re-rooted
+uint8_t coorParentPort = NO_PORT; // Port the coordinates were adopted from
+uint8_t coorChildPorts = 0;       // Ports of the blocks that adopted their coordinates from this one
+uint8_t lostHops = NO_HOPS;       // coorHops before an invalidation, NO_HOPS for a fresh block
+uint8_t knownPorts = 0;           // Grid ports already handled by onTopologyChanged
+uint8_t restoreFromFlash = 0;     // A persisted record waits for the ports to settle
+uint8_t unconfirmedCoordinates = 0; // Coordinates restored from flash, not yet confirmed by a neighbor
+uint8_t outbox[NB_SERIAL_PORT][L3_PAYLOAD_MAX]; // Frame being filled for each port
+uint8_t outboxSize[NB_SERIAL_PORT];
+uint16_t txMessages[NB_SERIAL_PORT][NB_COUNTED_TYPES];
+uint16_t rxMessages[NB_SERIAL_PORT][NB_COUNTED_TYPES];
+uint16_t txBytes[NB_COUNTED_TYPES];
+uint16_t rxBytes[NB_COUNTED_TYPES];
+uint16_t txPortBytes[STATS_VALUES]; // Message bytes sent per port
+uint16_t rxPortBytes[STATS_VALUES];
+uint16_t txL3[STATS_VALUES];      // L3 packets sent per port, frames among them, bytes (L3_FRAMES, L3_BYTES)
+uint16_t rxL3[STATS_VALUES];
+uint16_t latencyHistogram[2][LATENCY_BUCKETS]; // [0] rejected, [1] accepted colors
+uint32_t validationStart = 0;     // HAL_GetTick() when startColorValidation ran
+uint8_t validating = 0;
+uint8_t statsQueryId = 0;         // Last stats query seen
+uint8_t statsQuerySeen = 0;
+uint8_t statsUpPort = NO_PORT;    // Port towards the collector, NO_PORT on the collector itself
+SC_Check check;                   // Check initiated by this block
+sc_mask_t candidates = ALL_COLORS_MASK; // Bit c-1 set while color c is still possible here
 uint8_t notUpdateSent=0;
 
 enum direction { NORTH, BOTTOM, WEST, EAST, SOUTH, TOP };
 
-// Message structure for setting coordinates
-typedef struct __packed {
-    uint8_t type;  // Message type
-    int16_t x;     // X coordinate
-    int16_t y;     // Y coordinate
-} SetCoorMessage;
+// Ports lying in the plane of the grid, indexed by core direction (SC_DIR_XPLUS, XMINUS,
+// YPLUS, YMINUS); WEST and EAST are unused
+const uint8_t gridPorts[SC_NB_DIRS] = { NORTH, SOUTH, TOP, BOTTOM };
 
+// State saved to flash so a reset recovers without a full rebuild. Records are appended
+// one after the other in the page (wear leveling); the valid one with the highest seq wins.
 typedef struct __packed {
-    uint8_t type;  // Message type
-    uint8_t count;
+    uint16_t magic;
+    uint16_t seq;
+    int16_t x;
+    int16_t y;
+    uint16_t candidates;
     uint8_t color;
-} DialCheckMessage;
+    uint8_t hops;
+    uint8_t epoch;
+    uint8_t parentPort;
+    uint8_t portMask;   // Neighbors when the record was written, checked again on boot
+    uint8_t checksum;
+} PersistedState;
 
-typedef struct __packed {
-    uint8_t type;  // Message type
-    uint8_t processResponseType; // ACK FOR WHAT PURPOSE?
-    uint8_t isSuccess;
-    uint8_t color;
-} AcknowledgmentMessage;
+PersistedState persisted;         // Last record written or read
+uint16_t persistSlot = 0;         // Next free slot of the page
+
+// Stats query, flooded over the grid from the collector
+typedef SC_StatsQueryMessage StatsQueryMessage;
+
+// One section of the stats of a block, relayed back to the collector. Sections: 0-5 tx
+// messages of port n, 6-11 rx messages of port n, 12 tx message bytes, 13 rx message bytes,
+// 14 rejected latencies, 15 accepted latencies, 16 tx L3 packets, 17 rx L3 packets,
+// 18 tx message bytes per port, 19 rx message bytes per port. Counters saturate at COUNTER_MAX
+typedef SC_StatsReportMessage StatsReportMessage;
+
+// How a color index is shown on the LED: steady for the first four, blinking for the next ones
+typedef struct {
+    uint8_t led;
+    uint8_t blink;
+} ColorLook;
+
+const ColorLook colorLooks[9] = {
+    {GREEN, 0}, {BLUE, 0}, {ORANGE, 0}, {RED, 0},
+    {GREEN, 1}, {BLUE, 1}, {ORANGE, 1}, {RED, 1}, {WHITE, 1}
+};
+
+// Wire formats, see sudokuCore.h
+typedef SC_SetCoorMessage SetCoorMessage;
+typedef SC_CoorInvalidateMessage CoorInvalidateMessage;
+typedef SC_ChainCheckMessage ChainCheckMessage;
+typedef SC_DialCheckMessage DialCheckMessage;
+typedef SC_AckMessage AcknowledgmentMessage;
+typedef SC_CancelMessage CancelMessage;
+
+// A check relayed by this block on behalf of another initiator
+typedef SC_Relay RelayState;
+
+RelayState relays[SC_NB_RELAYS]; // Keyed by check type and initiator coordinates
 
 // Function prototypes
+uint32_t maskInterrupts();
+void restoreInterrupts(uint32_t primask);
+void sendPacket(uint8_t port, uint8_t *data, uint8_t size);
+void flushPort(uint8_t port);
+void flushOutboxes();
+uint8_t dispatchMessage(uint8_t *data, uint8_t size, uint8_t senderPort);
+void countUp(uint16_t *counter, uint16_t amount);
+void countMessage(uint16_t messages[][NB_COUNTED_TYPES], uint16_t *bytes, uint16_t *portBytes, uint8_t port, uint8_t type, uint8_t size);
+void countL3Packet(uint16_t *l3, uint8_t port, const uint8_t *data, uint8_t size);
+void sendL3Packet(uint8_t port, uint8_t *data, uint8_t size);
+void recordValidationLatency(uint8_t accepted);
+void startStatsQuery(uint8_t queryId);
+void processStatsQuery(StatsQueryMessage *msg, uint8_t senderPort);
+void processStatsReport(StatsReportMessage *msg, uint8_t senderPort);
+void dumpStatsReport(StatsReportMessage *msg);
+uint8_t formatNumber(char *text, int32_t value);
+void scheduleIn(uint32_t delay, TimerCallback callback);
+void cancelTimer(TimerCallback callback);
+void raiseEvent(uint8_t events);
+void runDueTimers(uint32_t now);
+void samplePorts();
+void blinkTick();
+void onTopologyChanged();
+void loadPersistedState();
+void restorePersistedState();
+void restorePersistedColors();
+void settleRestore();
+void persistState();
+uint8_t persistChecksum(const PersistedState *record);
+void electRoot();
+void retryCoordinates();
+uint8_t isOriginCorner();
+
 void updateCoordinatesBasedOnPort(int16_t receivedX, int16_t receivedY, uint8_t port);
 void propagateSetCoor(SetCoorMessage *message, uint8_t senderPort);
 void startSettingCoordinates();
-void sendDialMessage(uint8_t type, uint8_t count, uint8_t color, uint8_t port);
+void sendCoordinates(uint8_t port);
+void acceptCoordinates(SetCoorMessage *msg, uint8_t senderPort);
+void invalidateCoordinates();
+void forgetCoordinates();
+void reRoot();
+void sendToGridPorts(uint8_t *data, uint8_t size, uint8_t ports);
+void dropPortFromChecks(uint8_t port);
+void sendDialMessage(uint8_t type, uint8_t count, uint8_t color, uint8_t port, uint8_t seq, int16_t ox, int16_t oy);
+uint8_t dirOfPort(uint8_t port);
+uint8_t isPortInMyBox(uint8_t port);
+void sendChainMessage(uint8_t type, uint8_t color, uint8_t port, uint8_t seq, int16_t ox, int16_t oy);
+void sendAckMessage(uint8_t type, uint8_t processResponseType, uint8_t isSuccess, uint8_t port, uint8_t color, uint8_t seq, int16_t ox, int16_t oy);
+void sendCancelMessages(uint8_t processType, uint8_t seq, int16_t ox, int16_t oy, uint8_t ports);
 
-void processVerticalMessage(uint8_t color, uint8_t senderPort);
-void processHorizontalMessage(uint8_t color, uint8_t senderPort);
-void processDialMessage(uint8_t type, uint8_t count, uint8_t color, uint8_t senderPort);
-void processAckMessage(uint8_t processType, uint8_t isSuccess, uint8_t senderPort, uint8_t color);
+void processVerticalMessage(ChainCheckMessage *msg, uint8_t senderPort);
+void processHorizontalMessage(ChainCheckMessage *msg, uint8_t senderPort);
+void processDialMessage(DialCheckMessage *msg, uint8_t senderPort);
+void processAckMessage(uint8_t processType, uint8_t isSuccess, uint8_t senderPort, uint8_t color, uint8_t seq, int16_t ox, int16_t oy);
+void processCancelMessage(uint8_t processType, uint8_t seq, int16_t ox, int16_t oy, uint8_t senderPort);
 void processUpdateMessage(uint8_t senderPort, uint8_t color);
 
 void startColorValidation(uint8_t color);
@@ -73,43 +264,634 @@ void updateReceivedColorStatus(uint8_t color);
 
 void handleVerticalResponse(uint8_t isSuccess, uint8_t color);
 void handleHorizontalResponse(uint8_t isSuccess, uint8_t color);
+void handleDialResponse(uint8_t isSuccess, uint8_t color);
+void beginCheck(uint8_t type, uint8_t color);
+void finishCheck(uint8_t isSuccess, uint8_t color);
+RelayState *openRelay(uint8_t type, uint8_t seq, int16_t ox, int16_t oy, uint8_t upPort, uint8_t children, uint8_t color);
 void updateColorStatus(uint8_t color);
 void CheckColorStatus();
+void showColor(uint8_t color);
 
-// Initialization
-void BBinit() {
-    timeTreatment = HAL_GetTick();
-    currentColor = WHITE; // Default color
+// Add to a counter, saturating at COUNTER_MAX
+void countUp(uint16_t *counter, uint16_t amount) {
+    *counter = (*counter > COUNTER_MAX - amount) ? COUNTER_MAX : *counter + amount;
 }
 
-// Main loop
-void BBloop() {
-    uint32_t time = HAL_GetTick();
-    if (time > timeTreatment) {
-        timeTreatment = time + 500; // Update every 500ms
-        setColor(currentColor);
+// One message, framed or not
+void countMessage(uint16_t messages[][NB_COUNTED_TYPES], uint16_t *bytes, uint16_t *portBytes, uint8_t port, uint8_t type, uint8_t size) {
+    uint8_t column = (type >= 1 && type <= ACK_MSG) ? type - 1 : ACK_MSG;
+    if (port < NB_SERIAL_PORT) {
+        countUp(&messages[port][column], 1);
+        countUp(&portBytes[port], size);
+    }
+    countUp(&bytes[column], size);
+}
+
+// One L3 packet, with its whole length on the wire
+void countL3Packet(uint16_t *l3, uint8_t port, const uint8_t *data, uint8_t size) {
+    if (port < NB_SERIAL_PORT) {
+        countUp(&l3[port], 1);
+    }
+    if (data[0] == FRAME_MSG) {
+        countUp(&l3[L3_FRAMES], 1);
+    }
+    countUp(&l3[L3_BYTES], size);
+}
+
+// Packet handlers run from interrupts and send too: the outboxes and the tx counters they
+// share with BBloop are only touched with interrupts masked. Nests, from handlers as well
+uint32_t maskInterrupts() {
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    return primask;
+}
+
+void restoreInterrupts(uint32_t primask) {
+    __set_PRIMASK(primask);
+}
+
+// Every L3 packet leaves through here
+void sendL3Packet(uint8_t port, uint8_t *data, uint8_t size) {
+    uint32_t primask = maskInterrupts();
+    countL3Packet(txL3, port, data, size);
+    sendMessage(port, data, size, 1);
+    restoreInterrupts(primask);
+}
+
+// Every message leaves through here: it is counted, then queued in the frame of its port
+void sendPacket(uint8_t port, uint8_t *data, uint8_t size) {
+    uint32_t primask = maskInterrupts();
+    countMessage(txMessages, txBytes, txPortBytes, port, data[0], size);
+    if (port >= NB_SERIAL_PORT || FRAME_HEADER_SIZE + 1 + size > L3_PAYLOAD_MAX) {
+        sendL3Packet(port, data, size); // Too big to share a packet
+    } else {
+        if (!sc_frame_append(outbox[port], &outboxSize[port], L3_PAYLOAD_MAX, data, size)) {
+            flushPort(port);
+            sc_frame_append(outbox[port], &outboxSize[port], L3_PAYLOAD_MAX, data, size);
+        }
+        raiseEvent(EV_FLUSH);
+    }
+    restoreInterrupts(primask);
+}
+
+// Send the frame of a port; a lone sub-message goes out as a plain packet. The frame is sent
+// and emptied in one step, so a handler cannot append to it in between
+void flushPort(uint8_t port) {
+    uint32_t primask = maskInterrupts();
+    uint8_t *frame = outbox[port];
+    if (outboxSize[port] != 0) {
+        if (frame[1] == 1) {
+            sendL3Packet(port, frame + FRAME_HEADER_SIZE + 1, frame[FRAME_HEADER_SIZE]);
+        } else {
+            sendL3Packet(port, frame, outboxSize[port]);
+        }
+        outboxSize[port] = 0;
+    }
+    restoreInterrupts(primask);
+}
+
+void flushOutboxes() {
+    for (uint8_t p = 0; p < NB_SERIAL_PORT; ++p) {
+        flushPort(p);
+    }
+}
+
+void recordValidationLatency(uint8_t accepted) {
+    if (!validating) {
+        return;
+    }
+    validating = 0;
+    uint32_t ticks = (HAL_GetTick() - validationStart) >> 4;
+    uint8_t bucket = 0;
+    while (ticks && bucket < LATENCY_BUCKETS - 1) {
+        ticks >>= 1;
+        bucket++;
+    }
+    countUp(&latencyHistogram[accepted ? 1 : 0][bucket], 1);
+}
+
+// Start collecting the stats of the whole grid on this block
+void startStatsQuery(uint8_t queryId) {
+    StatsQueryMessage query = {STATS_QUERY_MSG, queryId};
+    processStatsQuery(&query, NO_PORT);
+}
+
+// Flood the query once, then send our own stats towards the collector
+void processStatsQuery(StatsQueryMessage *msg, uint8_t senderPort) {
+    if (statsQuerySeen && msg->queryId == statsQueryId) {
+        return; // Already answered
+    }
+    statsQuerySeen = 1;
+    statsQueryId = msg->queryId;
+    statsUpPort = senderPort; // NO_PORT on the collector
+    for (uint8_t i = 0; i < 4; ++i) {
+        uint8_t p = gridPorts[i];
+        if (p != senderPort && is_connected(p)) {
+            sendPacket(p, (uint8_t*)msg, sizeof(StatsQueryMessage));
+        }
+    }
+
+    StatsReportMessage report;
+    report.type = STATS_REPORT_MSG;
+    report.queryId = statsQueryId;
+    report.x = x;
+    report.y = y;
+    for (uint8_t section = 0; section < STATS_SECTIONS; ++section) {
+        const uint16_t *values;
+        if (section < NB_SERIAL_PORT) {
+            values = txMessages[section];
+        } else if (section < 2 * NB_SERIAL_PORT) {
+            values = rxMessages[section - NB_SERIAL_PORT];
+        } else if (section == 2 * NB_SERIAL_PORT) {
+            values = txBytes;
+        } else if (section == 2 * NB_SERIAL_PORT + 1) {
+            values = rxBytes;
+        } else if (section < 2 * NB_SERIAL_PORT + 4) {
+            values = latencyHistogram[section - 2 * NB_SERIAL_PORT - 2];
+        } else if (section == 2 * NB_SERIAL_PORT + 4) {
+            values = txL3;
+        } else if (section == 2 * NB_SERIAL_PORT + 5) {
+            values = rxL3;
+        } else if (section == 2 * NB_SERIAL_PORT + 6) {
+            values = txPortBytes;
+        } else {
+            values = rxPortBytes;
+        }
+        report.section = section;
+        memcpy(report.values, values, sizeof(report.values));
+        if (statsUpPort == NO_PORT) {
+            dumpStatsReport(&report);
+        } else {
+            sendPacket(statsUpPort, (uint8_t*)&report, sizeof(report));
+        }
+    }
+}
+
+// Pass a report of the subtree on towards the collector
+void processStatsReport(StatsReportMessage *msg, uint8_t senderPort) {
+    if (msg->queryId != statsQueryId || senderPort == statsUpPort) {
+        return; // Stale, or coming back down the query path
+    }
+    if (statsUpPort == NO_PORT) {
+        dumpStatsReport(msg);
+    } else {
+        sendPacket(statsUpPort, (uint8_t*)msg, sizeof(StatsReportMessage));
+    }
+}
+
+// Decimal digits of a value, returns their count
+uint8_t formatNumber(char *text, int32_t value) {
+    char digits[10];
+    uint8_t count = 0, size = 0;
+    uint32_t magnitude = value < 0 ? (uint32_t)-value : (uint32_t)value;
+    if (value < 0) {
+        text[size++] = '-';
+    }
+    do {
+        digits[count++] = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude);
+    while (count) {
+        text[size++] = digits[--count];
+    }
+    return size;
+}
+
+// One line per section on the serial console: STATS <query> (x,y) <section>: values
+void dumpStatsReport(StatsReportMessage *msg) {
+    char line[16 + 3 * 12 + STATS_VALUES * 6];
+    uint8_t size = 0;
+    uint16_t values[STATS_VALUES];
+    memcpy(values, msg->values, sizeof(values));
+    int16_t reportX = msg->x, reportY = msg->y;
+
+    memcpy(line, "STATS ", 6);
+    size = 6;
+    size += formatNumber(line + size, msg->queryId);
+    line[size++] = ' ';
+    line[size++] = '(';
+    size += formatNumber(line + size, reportX);
+    line[size++] = ',';
+    size += formatNumber(line + size, reportY);
+    line[size++] = ')';
+    line[size++] = ' ';
+    size += formatNumber(line + size, msg->section);
+    line[size++] = ':';
+    for (uint8_t i = 0; i < STATS_VALUES; ++i) {
+        line[size++] = ' ';
+        size += formatNumber(line + size, values[i]);
+    }
+    line[size++] = '\r';
+    line[size++] = '\n';
+    serial_send((uint8_t*)line, size);
+}
+
+// Arm `callback` to run in `delay` ms, replacing any pending run of the same callback
+void scheduleIn(uint32_t delay, TimerCallback callback) {
+    Timer *slot = NULL;
+    for (uint8_t i = 0; i < NB_TIMERS; ++i) {
+        if (timers[i].callback == callback) {
+            slot = &timers[i];
+            break;
+        }
+        if (!slot && timers[i].callback == NULL) {
+            slot = &timers[i];
+        }
+    }
+    if (!slot) {
+        // A callback would silently never run: stop here, blinking red fast (SysTick still
+        // ticks), so it is noticed
+        while (1) {
+            setColor(((HAL_GetTick() / TIMER_FAULT_PERIOD) & 1) ? BLACK : RED);
+        }
+    }
+    slot->due = HAL_GetTick() + delay;
+    slot->callback = callback;
+}
+
+void cancelTimer(TimerCallback callback) {
+    for (uint8_t i = 0; i < NB_TIMERS; ++i) {
+        if (timers[i].callback == callback) {
+            timers[i].callback = NULL;
+        }
+    }
+}
+
+void raiseEvent(uint8_t events) {
+    uint32_t primask = maskInterrupts();
+    pendingEvents |= events;
+    restoreInterrupts(primask);
+}
+
+void runDueTimers(uint32_t now) {
+    for (uint8_t i = 0; i < NB_TIMERS; ++i) {
+        TimerCallback callback = timers[i].callback;
+        if (callback && (int32_t)(now - timers[i].due) >= 0) {
+            timers[i].callback = NULL; // Free the slot first, the callback may re-arm itself
+            callback();
+        }
+    }
+}
+
+// Read the grid ports and report a change only
+void samplePorts() {
+    uint8_t mask = 0;
+    for (uint8_t i = 0; i < 4; ++i) {
+        if (is_connected(gridPorts[i])) {
+            mask |= PORT_BIT(gridPorts[i]);
+        }
+    }
+    if (mask != portMask) {
+        portMask = mask;
+        raiseEvent(EV_TOPOLOGY);
+    }
+    scheduleIn(PORT_SAMPLE_PERIOD, samplePorts);
+}
+
+void blinkTick() {
+    blinkPhase = !blinkPhase;
+    if (currentColor != NO_COLOR && colorLooks[currentColor - 1].blink) {
+        raiseEvent(EV_LED_DIRTY);
+    }
+    scheduleIn(BLINK_PERIOD, blinkTick);
+}
+
+// The origin is the corner with neighbors at TOP and NORTH and nobody at BOTTOM and SOUTH,
+// whatever the grid size. Both neighbors are required: with either one, several blocks of a
+// partial assembly could claim (0, 0) at the same epoch and hop count, and never reconcile
+uint8_t isOriginCorner() {
+    return (portMask & PORT_BIT(TOP)) && (portMask & PORT_BIT(NORTH))
+        && !(portMask & (PORT_BIT(BOTTOM) | PORT_BIT(SOUTH)));
+}
+
+// Repair the coordinates locally after neighbors joined or left
+void onTopologyChanged() {
+    if (restoreFromFlash) {
+        // After a power blip the links come up one by one: wait until they stop changing
+        scheduleIn(RESTORE_SETTLE_DELAY, settleRestore);
+        return;
+    }
+
+    uint8_t added = portMask & ~knownPorts;
+    uint8_t removed = knownPorts & ~portMask;
+    knownPorts = portMask;
+
+    for (uint8_t p = 0; p < NB_SERIAL_PORT; ++p) {
+        if (removed & PORT_BIT(p)) {
+            dropPortFromChecks(p);
+        }
+    }
+    coorChildPorts &= ~removed;
+
+    if (portMask == 0) {
+        // Taken out of the grid: it will be placed somewhere else
+        forgetCoordinates();
+        return;
+    }
+
+    if (hasSetCoordinates && coorParentPort != NO_PORT && (removed & PORT_BIT(coorParentPort))) {
+        if (coorHops == 1) {
+            reRoot(); // The root itself left
+        } else {
+            invalidateCoordinates();
+        }
+    }
+
+    if (hasSetCoordinates) {
+        // A block that joins gets its coordinates from any neighbor that has them
+        for (uint8_t p = 0; p < NB_SERIAL_PORT; ++p) {
+            if (added & PORT_BIT(p)) {
+                sendCoordinates(p);
+            }
+        }
+    } else if (lostHops == NO_HOPS && isOriginCorner()) {
+        // Fresh block at the corner: become the root unless a neighbor answers first
+        scheduleIn(ROOT_ELECTION_DELAY, electRoot);
+    }
+}
+
+// The ports have not changed for RESTORE_SETTLE_DELAY: restore the flash record if the neighbors
+// are the same as before the reset, or drop it for good
+void settleRestore() {
+    if (!restoreFromFlash || portMask == 0) {
+        return; // Still out of the grid: wait for the next change
     }
-    if (is_connected(TOP) && is_connected(NORTH) && !is_connected(BOTTOM) && !is_connected(SOUTH) && !hasSetCoordinates) {
+    restoreFromFlash = 0;
+    if (portMask == persisted.portMask) {
+        if (!hasSetCoordinates) {
+            restorePersistedState();
+        } else if (x == persisted.x && y == persisted.y) {
+            restorePersistedColors(); // A neighbor that settled first already gave us the same place
+        }
+    }
+    // Every port is new to onTopologyChanged: they get our coordinates, which is the
+    // handshake that confirms restored ones
+    onTopologyChanged();
+}
+
+void electRoot() {
+    if (!hasSetCoordinates && lostHops == NO_HOPS && isOriginCorner()) {
         hasSetCoordinates=1;
+        coorHops=0;
+        coorParentPort = NO_PORT;
         x=0;
         y=0;
         startSettingCoordinates();
     }
+}
+
+// Nobody closer to the root answered: take coordinates from any neighbor,
+// the invalidation had time to reach the whole subtree by now
+void retryCoordinates() {
+    if (!hasSetCoordinates) {
+        uint8_t request = COOR_REQUEST_MSG;
+        lostHops = NO_HOPS - 1;
+        sendToGridPorts(&request, 1, portMask);
+    }
+}
+
+uint8_t persistChecksum(const PersistedState *record) {
+    const uint8_t *bytes = (const uint8_t*)record;
+    uint8_t sum = 0;
+    for (uint8_t i = 0; i < sizeof(PersistedState) - 1; ++i) {
+        sum = (uint8_t)((sum << 1) | (sum >> 7)) ^ bytes[i];
+    }
+    return sum;
+}
+
+// Find the latest valid record and the next free slot
+void loadPersistedState() {
+    const PersistedState *slots = (const PersistedState*)PERSIST_PAGE_ADDR;
+    restoreFromFlash = 0;
+    persistSlot = PERSIST_SLOTS;
+    for (uint16_t i = 0; i < PERSIST_SLOTS; ++i) {
+        const PersistedState *record = &slots[i];
+        if (record->magic == 0xFFFF) {
+            persistSlot = i; // Erased: records are appended, so the rest is free too
+            break;
+        }
+        if (record->magic == PERSIST_MAGIC && record->checksum == persistChecksum(record)
+            && (!restoreFromFlash || (int16_t)(record->seq - persisted.seq) > 0)) {
+            persisted = *record;
+            restoreFromFlash = 1;
+        }
+    }
+}
+
+void restorePersistedState() {
+    x = persisted.x;
+    y = persisted.y;
+    coorHops = persisted.hops;
+    gridEpoch = persisted.epoch;
+    coorParentPort = persisted.parentPort;
+    hasSetCoordinates = 1;
+    unconfirmedCoordinates = (coorHops != 0);
+    lostHops = NO_HOPS;
+    restorePersistedColors();
+}
+
+void restorePersistedColors() {
+    candidates = persisted.candidates & ALL_COLORS_MASK;
+    currentColor = persisted.color <= NB_COLORS ? persisted.color : NO_COLOR;
+    raiseEvent(EV_LED_DIRTY);
+}
+
+// Append the current state to the flash page, erasing it once full
+void persistState() {
+    PersistedState record;
+    record.magic = PERSIST_MAGIC;
+    record.seq = persisted.seq + 1;
+    record.x = x;
+    record.y = y;
+    record.candidates = candidates;
+    record.color = currentColor;
+    record.hops = coorHops;
+    record.epoch = gridEpoch;
+    record.parentPort = coorParentPort;
+    record.portMask = portMask;
+    record.checksum = 0;
+    if (!hasSetCoordinates || memcmp(((uint8_t*)&record) + 4, ((uint8_t*)&persisted) + 4, sizeof(record) - 5) == 0) {
+        return; // Nothing worth keeping, or nothing new
+    }
+    record.checksum = persistChecksum(&record);
+
+    HAL_FLASH_Unlock();
+    if (persistSlot >= PERSIST_SLOTS) {
+        FLASH_EraseInitTypeDef erase;
+        uint32_t pageError;
+        erase.TypeErase = FLASH_TYPEERASE_PAGES;
+        erase.PageAddress = PERSIST_PAGE_ADDR;
+        erase.NbPages = 1;
+        HAL_FLASHEx_Erase(&erase, &pageError);
+        persistSlot = 0;
+    }
+    uint32_t address = PERSIST_PAGE_ADDR + persistSlot * sizeof(PersistedState);
+    const uint8_t *bytes = (const uint8_t*)&record;
+    for (uint8_t i = 0; i < sizeof(PersistedState); i += 2) {
+        HAL_FLASH_Program(FLASH_TYPEPROGRAM_HALFWORD, address + i, bytes[i] | (bytes[i + 1] << 8));
+    }
+    HAL_FLASH_Lock();
+
+    persistSlot++;
+    persisted = record;
+}
 
-    CheckColorStatus();
+// Initialization
+void BBinit() {
+    currentColor = NO_COLOR; // Default color
+    candidates = ALL_COLORS_MASK;
+    loadPersistedState();
+    scheduleIn(0, samplePorts);
+    scheduleIn(BLINK_PERIOD, blinkTick);
+    raiseEvent(EV_LED_DIRTY);
+}
+
+// Main loop: run what is due or dirty, then sleep until the next interrupt
+void BBloop() {
+    runDueTimers(HAL_GetTick());
+
+    // Packet handlers raise events from interrupts: take and clear them in one step
+    __disable_irq();
+    uint8_t events = pendingEvents;
+    pendingEvents = 0;
+    __enable_irq();
+    if (events & EV_TOPOLOGY) {
+        onTopologyChanged();
+    }
+    if (events & EV_COLOR_STATUS) {
+        CheckColorStatus();
+    }
+    if (events & EV_LED_DIRTY) {
+        showColor(currentColor);
+    }
+    // Last, so everything queued during this pass shares the packets
+    if (events & EV_FLUSH) {
+        flushOutboxes();
+    }
+
+#if LOW_POWER_IDLE
+    // SysTick and the serial ports wake the core up, so no timer or packet is missed. With
+    // interrupts masked, an event raised after the check still wakes __WFI up at once
+    __disable_irq();
+    if (!pendingEvents) {
+        __WFI();
+    }
+    __enable_irq();
+#endif
 }
 
 // Starts the coordinate propagation process
 void startSettingCoordinates() {
     // Create the SETCOOR_MSG packet
-    SetCoorMessage message = {SETCOOR_MSG, x, y};
+    SetCoorMessage message = {SETCOOR_MSG, x, y, coorHops, gridEpoch};
 
     // Broadcast the message to all connected neighbors
     for (uint8_t p = 0; p < NB_SERIAL_PORT; ++p) {
         if (is_connected(p)) {
-            sendMessage(p, (uint8_t*)&message, sizeof(message), 1);
+            sendPacket(p, (uint8_t*)&message, sizeof(message));
+        }
+    }
+}
+
+void sendCoordinates(uint8_t port) {
+    SetCoorMessage message = {SETCOOR_MSG, x, y, coorHops, gridEpoch};
+    sendPacket(port, (uint8_t*)&message, sizeof(message));
+}
+
+void sendToGridPorts(uint8_t *data, uint8_t size, uint8_t ports) {
+    for (uint8_t i = 0; i < 4; ++i) {
+        uint8_t p = gridPorts[i];
+        if ((ports & PORT_BIT(p)) && is_connected(p)) {
+            sendPacket(p, data, size);
+        }
+    }
+}
+
+// Take the coordinates of a neighbor if they are newer or come by a shorter path
+void acceptCoordinates(SetCoorMessage *msg, uint8_t senderPort) {
+    uint8_t newer = (int8_t)(msg->epoch - gridEpoch) > 0;
+    uint8_t accept;
+    if (unconfirmedCoordinates) {
+        // Restored from flash: a neighbor that agrees confirms them, one that disagrees wins
+        int16_t myX = x, myY = y;
+        updateCoordinatesBasedOnPort(msg->x, msg->y, senderPort);
+        uint8_t agrees = (x == myX && y == myY && msg->epoch == gridEpoch);
+        x = myX;
+        y = myY;
+        unconfirmedCoordinates = 0;
+        if (!agrees) {
+            hasSetCoordinates = 0;
+            lostHops = NO_HOPS;
         }
     }
+    if (hasSetCoordinates) {
+        accept = newer || (msg->epoch == gridEpoch && msg->hops + 1 < coorHops);
+    } else if (lostHops == NO_HOPS) {
+        accept = 1; // Fresh block
+    } else {
+        // Invalidated: a block that is not closer to the root may be one of our descendants
+        accept = newer || (msg->epoch == gridEpoch && msg->hops <= lostHops);
+    }
+    if (!accept) {
+        return;
+    }
+
+    if (hasSetCoordinates && coorParentPort != NO_PORT && coorParentPort != senderPort) {
+        sendAckMessage(ACK_MSG, SETCOOR_MSG, 0, coorParentPort, currentColor, 0, 0, 0); // Leave the old parent
+    }
+    cancelTimer(retryCoordinates);
+    cancelTimer(electRoot);
+
+    // Update local coordinates based on received data and port
+    updateCoordinatesBasedOnPort(msg->x, msg->y, senderPort);
+
+    hasSetCoordinates = 1;
+    coorHops = msg->hops + 1;
+    gridEpoch = msg->epoch;
+    coorParentPort = senderPort;
+    lostHops = NO_HOPS;
+    scheduleIn(PERSIST_DELAY, persistState);
+
+    SetCoorMessage message = {SETCOOR_MSG, x, y, coorHops, gridEpoch};
+
+    // Propagate the SetCoorMessage to neighbors except the sender
+    propagateSetCoor(&message, senderPort);
+
+    // Notify the sender with ACK: it is our parent now
+    sendAckMessage(ACK_MSG, SETCOOR_MSG, 1, senderPort, currentColor, 0, 0, 0);
+}
+
+// Our parent left: drop the coordinates of the whole subtree and ask the neighbors again
+void invalidateCoordinates() {
+    CoorInvalidateMessage invalidate = {COOR_INVALIDATE_MSG, gridEpoch};
+    uint8_t request = COOR_REQUEST_MSG;
+
+    sendToGridPorts((uint8_t*)&invalidate, sizeof(invalidate), coorChildPorts);
+    lostHops = coorHops;
+    hasSetCoordinates = 0;
+    coorHops = NO_HOPS;
+    coorParentPort = NO_PORT;
+    coorChildPorts = 0;
+
+    sendToGridPorts(&request, 1, portMask);
+    scheduleIn(COOR_RETRY_DELAY, retryCoordinates);
+}
+
+void forgetCoordinates() {
+    hasSetCoordinates = 0;
+    coorHops = NO_HOPS;
+    coorParentPort = NO_PORT;
+    coorChildPorts = 0;
+    lostHops = NO_HOPS;
+    cancelTimer(retryCoordinates);
+}
+
+// The root left: its former neighbors keep their coordinates and become the roots of a new epoch
+void reRoot() {
+    gridEpoch++;
+    coorHops = 0;
+    coorParentPort = NO_PORT;
+    startSettingCoordinates();
 }
 // Update local coordinates based on the received port direction
 void updateCoordinatesBasedOnPort(int16_t receivedX, int16_t receivedY, uint8_t port) {
@@ -135,69 +917,99 @@ void updateCoordinatesBasedOnPort(int16_t receivedX, int16_t receivedY, uint8_t
     }
 }
 
-// Propagate the SETCOOR_MSG to other neighbors except the sender
-// Propagate the SETCOOR_MSG to specific neighbors based on sender port
+// Propagate the SETCOOR_MSG to the other grid neighbors (breadth-first wave)
 void propagateSetCoor(SetCoorMessage *message, uint8_t senderPort) {
-    switch (senderPort) {
-        case BOTTOM:
-            if (is_connected(NORTH)) {
-                sendMessage(NORTH, (uint8_t*)message, sizeof(SetCoorMessage), 1);
-            }
-            if (is_connected(TOP)) {
-                sendMessage(TOP, (uint8_t*)message, sizeof(SetCoorMessage), 1);
-            }
-            break;
-        case SOUTH:
-            if (is_connected(NORTH)) {
-                sendMessage(NORTH, (uint8_t*)message, sizeof(SetCoorMessage), 1);
-            }
-            break;
-        default: // Handle other cases if necessary
-            break;
+    for (uint8_t i = 0; i < 4; ++i) {
+        uint8_t p = gridPorts[i];
+        if (p != senderPort && is_connected(p)) {
+            sendPacket(p, (uint8_t*)message, sizeof(SetCoorMessage));
+        }
     }
 }
-void sendDialMessage(uint8_t type, uint8_t count, uint8_t color, uint8_t port) {
-    DialCheckMessage msg = {type, count, color};
-    sendMessage(port, (uint8_t*)&msg, sizeof(msg), 1);
-}
-void sendAckMessage(uint8_t type, uint8_t processResponseType, uint8_t isSuccess, uint8_t port, uint8_t color) {
-AcknowledgmentMessage msg = {type, processResponseType, isSuccess, color};
-    sendMessage(port, (uint8_t*)&msg, sizeof(msg), 1);
+
+// Core direction of a grid port, SC_NO_DIR for WEST and EAST
+uint8_t dirOfPort(uint8_t port) {
+    for (uint8_t d = 0; d < SC_NB_DIRS; ++d) {
+        if (gridPorts[d] == port) {
+            return d;
+        }
+    }
+    return SC_NO_DIR;
 }
 
-// Function to broadcast a DIAL_MSG
-void processDialMessage(uint8_t type, uint8_t count, uint8_t color, uint8_t senderPort) {
-    if (count == 1) {
-        // First-level blocks: propagate to neighbors
-    nbrWaitedAnswers=count;
-        //nbrWaitedAnswers++;      // Increment number of waited answers
-        parentPort = senderPort; // Record the sender port as parent
+// Is the neighbor behind `port` connected and part of the same box as this block?
+uint8_t isPortInMyBox(uint8_t port) {
+    uint8_t dir = dirOfPort(port);
+    return dir != SC_NO_DIR && is_connected(port) && sc_step_in_box(x, y, dir, BOX_WIDTH, BOX_HEIGHT);
+}
 
-        // Propagation logic based on the sender port
-        if (senderPort == SOUTH || senderPort == NORTH) {
-            // Message received from SOUTH or NORTH
-            if ((y==0 || y==2) && is_connected(TOP)) {
-                sendDialMessage(DIAL_MSG, 2, color, TOP);
-            } else if ((y==1 || y==3) && is_connected(BOTTOM)) {
-                sendDialMessage(DIAL_MSG, 2, color, BOTTOM);
-            }
-        } else if (senderPort == BOTTOM || senderPort == TOP) {
-            // Message received from BOTTOM or TOP
-            if ((x==0 || x==2) && is_connected(NORTH)) {
-                sendDialMessage(DIAL_MSG, 2, color, NORTH);
-            } else if ((x==1 || x==3) && is_connected(SOUTH)) {
-                sendDialMessage(DIAL_MSG, 2, color, SOUTH);
-            }
+void sendDialMessage(uint8_t type, uint8_t count, uint8_t color, uint8_t port, uint8_t seq, int16_t ox, int16_t oy) {
+    DialCheckMessage msg = {type, count, color, seq, ox, oy};
+    sendPacket(port, (uint8_t*)&msg, sizeof(msg));
+}
+void sendChainMessage(uint8_t type, uint8_t color, uint8_t port, uint8_t seq, int16_t ox, int16_t oy) {
+    ChainCheckMessage msg = {type, color, seq, ox, oy};
+    sendPacket(port, (uint8_t*)&msg, sizeof(msg));
+}
+void sendAckMessage(uint8_t type, uint8_t processResponseType, uint8_t isSuccess, uint8_t port, uint8_t color, uint8_t seq, int16_t ox, int16_t oy) {
+AcknowledgmentMessage msg = {type, processResponseType, isSuccess, color, seq, ox, oy};
+    sendPacket(port, (uint8_t*)&msg, sizeof(msg));
+}
+// Tell every port in `ports` to drop the given check
+void sendCancelMessages(uint8_t processType, uint8_t seq, int16_t ox, int16_t oy, uint8_t ports) {
+    CancelMessage msg = {CANCEL_MSG, processType, seq, ox, oy};
+    for (uint8_t p = 0; p < NB_SERIAL_PORT; ++p) {
+        if ((ports & PORT_BIT(p)) && is_connected(p)) {
+            sendPacket(p, (uint8_t*)&msg, sizeof(msg));
         }
-    } else if (count == 2) {
-        // Second-level blocks: perform color check
-        if (currentColor != color) {
-        // Acknowledge accept!
+    }
+}
+
+// Relay a check for its initiator; NULL when the table is full, and the check must be failed:
+// it cannot be followed to the end, and failing never accepts a conflicting color
+RelayState *openRelay(uint8_t type, uint8_t seq, int16_t ox, int16_t oy, uint8_t upPort, uint8_t children, uint8_t color) {
+    RelayState *relay = sc_relay_slot(relays, type, ox, oy);
+    if (relay) {
+        sc_relay_open(relay, type, seq, ox, oy, upPort, children, color);
+    }
+    return relay;
+}
+
+// Relay a DIAL_MSG through the box (the core's comb) and check the cells outside the
+// initiator's row and column, which are covered by the other checks.
+void processDialMessage(DialCheckMessage *msg, uint8_t senderPort) {
+    uint8_t color = msg->color;
+    uint8_t seq = msg->seq;
+    uint8_t mustCheck = sc_dial_must_check(x, y, msg->ox, msg->oy);
+
+    if (mustCheck && currentColor == color) {
+        sendAckMessage(ACK_MSG, DIAL_MSG, 0, senderPort, color, seq, msg->ox, msg->oy);
+        return;
+    }
+    if (mustCheck) {
         updateColorStatus(color);
-        sendAckMessage(ACK_MSG, DIAL_MSG, 1, senderPort, color);   // Acknowledge success to the current port
-        } else {
-            // Acknowledge no change
-            sendAckMessage(ACK_MSG, DIAL_MSG, 0, senderPort, color);
+    }
+
+    uint8_t children = 0;
+    uint8_t dirs = sc_dial_children(x, y, msg->oy, dirOfPort(senderPort), BOX_WIDTH, BOX_HEIGHT);
+    for (uint8_t d = 0; d < SC_NB_DIRS; ++d) {
+        if ((dirs & PORT_BIT(d)) && is_connected(gridPorts[d])) {
+            children |= PORT_BIT(gridPorts[d]);
+        }
+    }
+
+    if (children == 0) {
+        // Last cell of its branch: acknowledge success to the current port
+        sendAckMessage(ACK_MSG, DIAL_MSG, 1, senderPort, color, seq, msg->ox, msg->oy);
+        return;
+    }
+    if (!openRelay(DIAL_MSG, seq, msg->ox, msg->oy, senderPort, children, color)) {
+        sendAckMessage(ACK_MSG, DIAL_MSG, 0, senderPort, color, seq, msg->ox, msg->oy);
+        return;
+    }
+    for (uint8_t p = 0; p < NB_SERIAL_PORT; ++p) {
+        if (children & PORT_BIT(p)) {
+            sendDialMessage(DIAL_MSG, msg->count + 1, color, p, seq, msg->ox, msg->oy);
         }
     }
 }
@@ -208,7 +1020,7 @@ void startUpdateMessage(uint8_t color){
     // Broadcast the message to all connected neighbors
     for (uint8_t p = 0; p < NB_SERIAL_PORT; ++p) {
         if (is_connected(p)) {
-       sendMessage(p, data, 2, 1);
+       sendPacket(p, data, 2);
         }
     }
 }
@@ -217,75 +1029,65 @@ void processUpdateMessage(uint8_t senderPort, uint8_t color){
     uint8_t data[2] = { UPDATE_MSG, color };
     updateColorStatus(color);
     if (senderPort == NORTH && is_connected(SOUTH)){
-        sendMessage(SOUTH, data, 2, 1);
+        sendPacket(SOUTH, data, 2);
         }
     else if (senderPort == SOUTH && is_connected(NORTH)){
-        sendMessage(NORTH, data, 2, 1);
+        sendPacket(NORTH, data, 2);
         }
     else if (senderPort == TOP && is_connected(BOTTOM)){
-        sendMessage(BOTTOM, data, 2, 1);
+        sendPacket(BOTTOM, data, 2);
         }
     else if (senderPort == BOTTOM && is_connected(TOP)){
-        sendMessage(TOP, data, 2, 1);
+        sendPacket(TOP, data, 2);
         }
 }
 
+void showColor(uint8_t color) {
+    if (color == NO_COLOR) {
+        setColor(WHITE);
+        return;
+    }
+    const ColorLook *look = &colorLooks[color - 1];
+    setColor((look->blink && blinkPhase) ? BLACK : look->led);
+}
+
 void updateColorStatus(uint8_t color) {
-    // Check if the color is already processed; skip if so
-	if(expectedColorsRemains>1){
-	switch (color) {
-        case GREEN:
-            if (canBeGreen == 0) return;
-            else {canBeGreen = 0; expectedColorsRemains--;}
-            break;
-        case BLUE:
-            if (canBeBlue == 0) return;
-            else {canBeBlue = 0; expectedColorsRemains--;}
-            break;
-        case ORANGE:
-            if (canBeOrange == 0) return;
-            else {canBeOrange = 0; expectedColorsRemains--;}
-            break;
-        case RED:
-            if (canBeRed == 0) return;
-            else {canBeRed = 0; expectedColorsRemains--;}
-            break;
-    	}
-	}
+    if (color == NO_COLOR || color > NB_COLORS) {
+        return; // Not a color of this grid
+    }
+    // Never drops the last candidate, and skips colors already processed
+    if (sc_eliminate(&candidates, color)) {
+        raiseEvent(EV_COLOR_STATUS);
+    }
 }
 
 
 void updateReceivedColorStatus(uint8_t color) {
-    expectedColorsRemains = 1;
-    canBeGreen = canBeBlue = canBeRed = canBeOrange = 0;
-    switch (color) {
-        case GREEN: canBeGreen = 1; break;
-        case BLUE: canBeBlue = 1; break;
-        case ORANGE: canBeOrange = 1; break;
-        case RED: canBeRed = 1; break;
+    if (color == NO_COLOR || color > NB_COLORS) {
+        return; // Not a color of this grid
     }
+    candidates = COLOR_BIT(color);
+    raiseEvent(EV_COLOR_STATUS);
 }
 
 void CheckColorStatus() {
-    if (expectedColorsRemains == 1) {
-        if (canBeGreen) {
-            currentColor = GREEN;
-        } else if (canBeBlue) {
-            currentColor = BLUE;
-        } else if (canBeOrange) {
-            currentColor = ORANGE;
-        } else if (canBeRed) {
-            currentColor = RED;
-        }
-        setColor(currentColor); // Call only once after the decision
+    uint8_t decided = sc_single_value(candidates);
+    if (decided != NO_COLOR) {
+        if (decided == currentColor) {
+            return; // Already decided and announced
+        }
+        currentColor = decided;
+        raiseEvent(EV_LED_DIRTY); // Call only once after the decision
         startUpdateMessage(currentColor);
+        scheduleIn(PERSIST_DELAY, persistState);
     }
 }
 
-void processVerticalMessage(uint8_t color, uint8_t senderPort) {
+void processVerticalMessage(ChainCheckMessage *msg, uint8_t senderPort) {
+    uint8_t color = msg->color;
     if (currentColor == color) {
-        // Acknowledge no change; the block already has the desired color
-        sendAckMessage(ACK_MSG, VERTICAL_MSG, 0, senderPort, color);
+        // Conflict found here: answer at once, relays pass it straight back to the initiator
+        sendAckMessage(ACK_MSG, VERTICAL_MSG, 0, senderPort, color, msg->seq, msg->ox, msg->oy);
         return;
     }
 
@@ -293,21 +1095,23 @@ void processVerticalMessage(uint8_t color, uint8_t senderPort) {
     uint8_t oppositePort = (senderPort == TOP) ? BOTTOM : TOP;
     if (is_connected(oppositePort)) {
         // Forward the vertical message to the connected port
-        uint8_t data[2] = { VERTICAL_MSG, color };
-        nbrWaitedAnswers++; // Increment the number of awaited answers
-        sendMessage(oppositePort, data, 2, 1);
+        if (!openRelay(VERTICAL_MSG, msg->seq, msg->ox, msg->oy, senderPort, PORT_BIT(oppositePort), color)) {
+            sendAckMessage(ACK_MSG, VERTICAL_MSG, 0, senderPort, color, msg->seq, msg->ox, msg->oy);
+            return;
+        }
+        sendChainMessage(VERTICAL_MSG, color, oppositePort, msg->seq, msg->ox, msg->oy);
     } else {
         // Edge case: this is the topmost or bottommost block
         // Acknowledge success to the sender port
-        sendAckMessage(ACK_MSG, VERTICAL_MSG, 1, senderPort, color);
+        sendAckMessage(ACK_MSG, VERTICAL_MSG, 1, senderPort, color, msg->seq, msg->ox, msg->oy);
     }
 }
 
-void processHorizontalMessage(uint8_t color, uint8_t senderPort) {
-
+void processHorizontalMessage(ChainCheckMessage *msg, uint8_t senderPort) {
+    uint8_t color = msg->color;
 if (currentColor == color) {
-        // Acknowledge no change; the block already has the desired color
-        sendAckMessage(ACK_MSG, HORIZONTAL_MSG, 0, senderPort, color);
+        // Conflict found here: answer at once, relays pass it straight back to the initiator
+        sendAckMessage(ACK_MSG, HORIZONTAL_MSG, 0, senderPort, color, msg->seq, msg->ox, msg->oy);
         return;
     }
 
@@ -315,89 +1119,118 @@ if (currentColor == color) {
     uint8_t oppositePort = (senderPort == NORTH) ? SOUTH : NORTH;
     if (is_connected(oppositePort)) {
         // Forward the horizontal message to the connected port
-        uint8_t data[2] = { HORIZONTAL_MSG, color };
-        nbrWaitedAnswers++; // Increment the number of awaited answers
-        sendMessage(oppositePort, data, 2, 1);
+        if (!openRelay(HORIZONTAL_MSG, msg->seq, msg->ox, msg->oy, senderPort, PORT_BIT(oppositePort), color)) {
+            sendAckMessage(ACK_MSG, HORIZONTAL_MSG, 0, senderPort, color, msg->seq, msg->ox, msg->oy);
+            return;
+        }
+        sendChainMessage(HORIZONTAL_MSG, color, oppositePort, msg->seq, msg->ox, msg->oy);
     } else {
         // Edge case: this is the northernmost or southernmost block
         // Acknowledge success to the sender port
-        sendAckMessage(ACK_MSG, HORIZONTAL_MSG, 1, senderPort, color);
+        sendAckMessage(ACK_MSG, HORIZONTAL_MSG, 1, senderPort, color, msg->seq, msg->ox, msg->oy);
     }
 }
 
-void processAckMessage(uint8_t processType, uint8_t isSuccess, uint8_t senderPort, uint8_t color) {
-    if (processType == VERTICAL_MSG) {
-        // Determine the opposite port for vertical check
-        uint8_t oppositePort = (senderPort == TOP) ? BOTTOM : TOP;
-
-        if (nbrWaitedAnswers > 0) {
-            nbrWaitedAnswers--; // Decrement acknowledgment counter
+void processAckMessage(uint8_t processType, uint8_t isSuccess, uint8_t senderPort, uint8_t color, uint8_t seq, int16_t ox, int16_t oy) {
+    if (processType == SETCOOR_MSG) {
+        // A neighbor adopted (or left) us as its coordinate parent
+        if (isSuccess) {
+            coorChildPorts |= PORT_BIT(senderPort);
+        } else {
+            coorChildPorts &= ~PORT_BIT(senderPort);
         }
+        return;
+    }
+    if (processType < HORIZONTAL_MSG || processType > DIAL_MSG) {
+        return;
+    }
 
-        if(myCount==0 && nbrWaitedAnswers>0){
-        firstNbrResponse= isSuccess;
-        }
-        else if(myCount==0 && nbrWaitedAnswers==0){
-        secondNbrResponse= isSuccess;
-        myCount=232;
-        handleVerticalResponse((firstNbrResponse && secondNbrResponse), color);
-        }
-        else if (nbrWaitedAnswers==0 && myCount != 0){
-        sendAckMessage(ACK_MSG, VERTICAL_MSG, isSuccess, oppositePort, color);
+    // Answer to a check initiated by this block; on failure, stop the branches still in flight
+    uint8_t cancelPorts;
+    if (ox == x && oy == y) {
+        uint8_t result = sc_check_answer(&check, processType, seq, senderPort, isSuccess, &cancelPorts);
+        sendCancelMessages(processType, seq, x, y, cancelPorts);
+        if (result == SC_ACCEPTED || result == SC_REJECTED) {
+            finishCheck(result == SC_ACCEPTED, color);
         }
+        return;
     }
-    else if (processType == HORIZONTAL_MSG) {
-        // Determine the opposite port for horizontal check
-        uint8_t oppositePort = (senderPort == NORTH) ? SOUTH : NORTH;
 
-        if (nbrWaitedAnswers > 0) {
-            nbrWaitedAnswers--; // Decrement acknowledgment counter
-            }
-            if(myCount==0 && nbrWaitedAnswers>0){
-            firstNbrResponse= isSuccess;
-            }
-            else if(myCount==0 && nbrWaitedAnswers==0){
-            secondNbrResponse= isSuccess;
-            myCount=232;
-            handleHorizontalResponse((firstNbrResponse && secondNbrResponse), color);
-        }
-            else if (nbrWaitedAnswers==0 && myCount != 0){
-            sendAckMessage(ACK_MSG, HORIZONTAL_MSG, isSuccess, oppositePort, color); //HORIZONTAL_MSG handleHorizontalResponse
-        }
+    // Answer to a check relayed on behalf of another block
+    RelayState *relay = sc_relay_find(relays, processType, ox, oy);
+    uint8_t result = sc_relay_answer(relay, seq, senderPort, isSuccess, &cancelPorts);
+    sendCancelMessages(processType, seq, ox, oy, cancelPorts);
+    if (result == SC_ACCEPTED || result == SC_REJECTED) {
+        sendAckMessage(ACK_MSG, processType, isSuccess, relay->upPort, color, seq, ox, oy);
+    }
+}
 
+void processCancelMessage(uint8_t processType, uint8_t seq, int16_t ox, int16_t oy, uint8_t senderPort) {
+    if (processType < HORIZONTAL_MSG || processType > DIAL_MSG) {
+        return;
     }
-    else if (processType == DIAL_MSG) {
-        if (nbrWaitedAnswers > 0) {
-            nbrWaitedAnswers--; // Decrement acknowledgment counter
-        }
-        if(myCount==0 && nbrWaitedAnswers>0){
-            firstNbrResponse= isSuccess;
-        }
-        else if(myCount==0 && nbrWaitedAnswers==0){
-        secondNbrResponse= isSuccess;
-        myCount=232;
-    	currentColor=GREEN;
-    	setColor(currentColor);
-            if(firstNbrResponse && secondNbrResponse) {
-                //firstNbrResponse= secondNbrResponse= 1;
+    // Pass the cancel on so the rest of the line stops too
+    uint8_t cancelPorts;
+    if (sc_relay_cancel(sc_relay_find(relays, processType, ox, oy), seq, senderPort, &cancelPorts)) {
+        sendCancelMessages(processType, seq, ox, oy, cancelPorts);
+    }
+}
 
-                updateReceivedColorStatus(color);
-                startUpdateMessage(color);
-            }
+// A neighbor that left never answers, and the blocks beyond it were not checked: its missing
+// answers count as failures, so the initiator rejects the color rather than accept it unchecked
+void dropPortFromChecks(uint8_t port) {
+    for (uint8_t i = 0; i < SC_NB_RELAYS; ++i) {
+        RelayState *relay = &relays[i];
+        if (!relay->active) {
+            continue;
         }
-        else if (nbrWaitedAnswers==0 && parentPort != -1){
-            uint8_t port =parentPort;
-            parentPort = -1; // Reset parent port
-            sendAckMessage(ACK_MSG, DIAL_MSG, isSuccess, port, color);
+        uint8_t cancelPorts;
+        if (sc_relay_cancel(relay, relay->seq, port, &cancelPorts)) {
+            sendCancelMessages(relay->type, relay->seq, relay->ox, relay->oy, cancelPorts);
+        } else if (relay->pendingPorts & PORT_BIT(port)) {
+            processAckMessage(relay->type, 0, port, relay->color, relay->seq, relay->ox, relay->oy);
         }
     }
+    if (check.active && (check.pendingPorts & PORT_BIT(port))) {
+        processAckMessage(check.type, 0, port, check.color, check.seq, x, y);
+    }
 }
 
 void startColorValidation(uint8_t color){
+    validationStart = HAL_GetTick();
+    validating = 1;
     startVerticalCheck(color);
 
 }
 
+// Reset the initiator state for a new check of the given type
+void beginCheck(uint8_t type, uint8_t color) {
+    // A previous check is superseded, release its relays
+    uint8_t previousType = check.type;
+    uint8_t previousSeq = check.seq;
+    uint8_t stalePorts = sc_check_begin(&check, type, color);
+    sendCancelMessages(previousType, previousSeq, x, y, stalePorts);
+}
+
+void finishCheck(uint8_t isSuccess, uint8_t color) {
+    check.active = 0;
+    check.pendingPorts = 0;
+    if (!isSuccess) {
+        recordValidationLatency(0);
+    }
+    switch (check.type) {
+        case VERTICAL_MSG:
+            handleVerticalResponse(isSuccess, color);
+            break;
+        case HORIZONTAL_MSG:
+            handleHorizontalResponse(isSuccess, color);
+            break;
+        case DIAL_MSG:
+            handleDialResponse(isSuccess, color);
+            break;
+    }
+}
+
 void handleVerticalResponse(uint8_t isSuccess, uint8_t color) {
     if (isSuccess) {
         // Proceed to horizontal check and dial check only if vertical check is successful
@@ -412,120 +1245,166 @@ void handleHorizontalResponse(uint8_t isSuccess, uint8_t color) {
     }
 }
 
+void handleDialResponse(uint8_t isSuccess, uint8_t color) {
+    if (isSuccess) {
+        recordValidationLatency(1);
+        updateReceivedColorStatus(color);
+        startUpdateMessage(color);
+    }
+}
+
 void startVerticalCheck(uint8_t color) {
-    nbrWaitedAnswers = 0; // Reset the number of waited acknowledgments
-    myCount = 0;
-    firstNbrResponse = 1;
-    secondNbrResponse = 0;
+    beginCheck(VERTICAL_MSG, color);
 
     if (is_connected(TOP)) {
-        uint8_t data[2] = { VERTICAL_MSG, color };
-        nbrWaitedAnswers++;      // Increment number of waited answers
-        sendMessage(TOP, data, 2, 1);
+        sc_check_expect(&check, TOP);
+        sendChainMessage(VERTICAL_MSG, color, TOP, check.seq, x, y);
     }
 
     // Send message to the BOTTOM neighbor if connected
     if (is_connected(BOTTOM)) {
-        uint8_t data[2] = { VERTICAL_MSG, color };
-        nbrWaitedAnswers++;      // Increment number of waited answers
-        sendMessage(BOTTOM, data, 2, 1);
+        sc_check_expect(&check, BOTTOM);
+        sendChainMessage(VERTICAL_MSG, color, BOTTOM, check.seq, x, y);
+    }
+
+    if (sc_check_started(&check) == SC_ACCEPTED) {
+        finishCheck(1, color); // Alone in the column
     }
 }
 
 void startHorizontalCheck(uint8_t color) {
-    // Send message to the NORTH neighbor if connected
-    nbrWaitedAnswers = 0; // Reset the number of waited acknowledgments
-    myCount = 0;
-    firstNbrResponse = 1;
-    secondNbrResponse = 0;
+    beginCheck(HORIZONTAL_MSG, color);
 
+    // Send message to the NORTH neighbor if connected
     if (is_connected(NORTH)) {
-        uint8_t data[2] = { HORIZONTAL_MSG, color };
-        nbrWaitedAnswers++;      // Increment number of waited answers
-        sendMessage(NORTH, data, 2, 1);
+        sc_check_expect(&check, NORTH);
+        sendChainMessage(HORIZONTAL_MSG, color, NORTH, check.seq, x, y);
     }
 
     // Send message to the SOUTH neighbor if connected
     if (is_connected(SOUTH)) {
-        uint8_t data[2] = { HORIZONTAL_MSG, color };
-        nbrWaitedAnswers++;      // Increment number of waited answers
-        sendMessage(SOUTH, data, 2, 1);
+        sc_check_expect(&check, SOUTH);
+        sendChainMessage(HORIZONTAL_MSG, color, SOUTH, check.seq, x, y);
+    }
+
+    if (sc_check_started(&check) == SC_ACCEPTED) {
+        finishCheck(1, color); // Alone in the row
     }
 }
 
 void startDialCheck(uint8_t color) {
+    beginCheck(DIAL_MSG, color);
 
-    nbrWaitedAnswers = 2; // Reset the number of waited acknowledgments
-    myCount = 0;
-    firstNbrResponse = 1;
-    secondNbrResponse = 0;
-
-    // First neighbor based on `x` value
-    if ((x==0 || x==2) && is_connected(NORTH)) {
-        sendDialMessage(DIAL_MSG, 1, color, NORTH);
-    } else if ((x==1 || x==3) && is_connected(SOUTH)) {
-        sendDialMessage(DIAL_MSG, 1, color, SOUTH);
+    // Start the comb in every direction that stays inside the box
+    for (uint8_t d = 0; d < SC_NB_DIRS; ++d) {
+        uint8_t p = gridPorts[d];
+        if (isPortInMyBox(p)) {
+            sc_check_expect(&check, p);
+            sendDialMessage(DIAL_MSG, 1, color, p, check.seq, x, y);
+        }
     }
 
-    // Second neighbor based on `y` value
-    if ((y==0 || y==2) && is_connected(TOP)) {
-        sendDialMessage(DIAL_MSG, 1, color, TOP);
-    } else if ((y==1 || y==3)  && is_connected(BOTTOM)) {
-        sendDialMessage(DIAL_MSG, 1, color, BOTTOM);
+    if (sc_check_started(&check) == SC_ACCEPTED) {
+        finishCheck(1, color); // Alone in the box
     }
 }
 
+// Unpack frames, hand plain packets over as they are
 uint8_t process_standard_packet(L3_packet *packet) {
-    uint8_t msgType = packet->packet_content[0];
     uint8_t senderPort = packet->io_port;
     uint8_t* data = packet->packet_content;
-    uint8_t rcvColor= data[1];
-
-    switch (msgType) {
-        case SETCOOR_MSG: {
-            SetCoorMessage *setCoorMsg = (SetCoorMessage*)packet->packet_content;
-
-            if (!hasSetCoordinates) {
-                // Update local coordinates based on received data and port
-                updateCoordinatesBasedOnPort(setCoorMsg->x, setCoorMsg->y, senderPort);
+    uint8_t packetSize = packet->packet_size;
 
-                hasSetCoordinates = 1;
-
-                SetCoorMessage message = {SETCOOR_MSG, x, y};
+    countL3Packet(rxL3, senderPort, data, packetSize);
+    if (data[0] != FRAME_MSG) {
+        return dispatchMessage(data, packetSize, senderPort);
+    }
+    // Sub-messages never run past the bytes actually received
+    uint8_t offset = 0;
+    const uint8_t *msg;
+    uint8_t size;
+    for (uint8_t i = 0; i < data[1] && sc_frame_next(data, packetSize, &offset, &msg, &size); ++i) {
+        dispatchMessage((uint8_t*)msg, size, senderPort);
+    }
+    return 1;
+}
 
-                // Propagate the SetCoorMessage to neighbors except the sender
-                propagateSetCoor(&message, senderPort);
+// `size` is the number of bytes actually received for this message; one shorter than its
+// type is counted, then dropped, so a truncated or corrupt frame is never read past its end
+uint8_t dispatchMessage(uint8_t *data, uint8_t size, uint8_t senderPort) {
+    if (size == 0) {
+        return 0;
+    }
+    uint8_t msgType = data[0];
+    countMessage(rxMessages, rxBytes, rxPortBytes, senderPort, msgType, size);
+    if (size < sc_message_size(msgType)) {
+        return 0;
+    }
+    uint8_t rcvColor = size > 1 ? data[1] : NO_COLOR; // COOR_REQUEST_MSG is the type alone
 
-                // Notify the sender with ACK
-                uint8_t ackData[1] = {ACK_MSG};
-                sendMessage(packet->io_port, ackData, 1, 1);
+    switch (msgType) {
+        case SETCOOR_MSG: {
+            acceptCoordinates((SetCoorMessage*)data, senderPort);
+            return 1;
+        }
+        case COOR_REQUEST_MSG: {
+            if (hasSetCoordinates) {
+                sendCoordinates(senderPort);
             }
             return 1;
         }
+        case COOR_INVALIDATE_MSG: {
+            CoorInvalidateMessage *invalidateMsg = (CoorInvalidateMessage*)data;
+            if (hasSetCoordinates && senderPort == coorParentPort && invalidateMsg->epoch == gridEpoch) {
+                invalidateCoordinates();
+            }
+            return 1;
+        }
+        case STATS_QUERY_MSG: {
+            StatsQueryMessage *query = (StatsQueryMessage*)data;
+            if (senderPort == WEST || senderPort == EAST) {
+                startStatsQuery(query->queryId); // From the input block, outside the grid plane
+            } else {
+                processStatsQuery(query, senderPort);
+            }
+            return 1;
+        }
+        case STATS_REPORT_MSG: {
+            processStatsReport((StatsReportMessage*)data, senderPort);
+            return 1;
+        }
         case COLOR_MSG: {
-            // Handle COLOR_MSG
-        	if (currentColor != rcvColor){
+            // Handle COLOR_MSG: the input block sends a color index, 1..9
+        	if (rcvColor != NO_COLOR && rcvColor <= NB_COLORS && currentColor != rcvColor){
         		startColorValidation(rcvColor);
         	}
             break;
         }
         case DIAL_MSG: {
             // Process the DIAL CHECK message
-            DialCheckMessage *dialMsg = (DialCheckMessage *)packet->packet_content;
-            processDialMessage(dialMsg->type, dialMsg->count,  dialMsg->color, senderPort); // Pass the message to processDialMessage
+            DialCheckMessage *dialMsg = (DialCheckMessage *)data;
+            processDialMessage(dialMsg, senderPort); // Pass the message to processDialMessage
             break;
         }
         case ACK_MSG:{
-        AcknowledgmentMessage *ackMsg = (AcknowledgmentMessage *)packet->packet_content;
-            processAckMessage(ackMsg->processResponseType, ackMsg->isSuccess, senderPort, ackMsg->color);
+        AcknowledgmentMessage *ackMsg = (AcknowledgmentMessage *)data;
+            processAckMessage(ackMsg->processResponseType, ackMsg->isSuccess, senderPort, ackMsg->color, ackMsg->seq,
+                              ackMsg->ox, ackMsg->oy);
+            break;
+        }
+        case CANCEL_MSG:{
+        CancelMessage *cancelMsg = (CancelMessage *)data;
+            processCancelMessage(cancelMsg->processType, cancelMsg->seq, cancelMsg->ox, cancelMsg->oy, senderPort);
             break;
         }
         case HORIZONTAL_MSG:{
-        processHorizontalMessage(rcvColor, senderPort);
+        ChainCheckMessage *checkMsg = (ChainCheckMessage *)data;
+        processHorizontalMessage(checkMsg, senderPort);
             break;
         }
         case VERTICAL_MSG:{
-        processVerticalMessage(rcvColor, senderPort);
+        ChainCheckMessage *checkMsg = (ChainCheckMessage *)data;
+        processVerticalMessage(checkMsg, senderPort);
             break;
         }
         case UPDATE_MSG:{
@@ -536,5 +1415,5 @@ uint8_t process_standard_packet(L3_packet *packet) {
             return 0;
         }
     }
+    return 1;
 }
-
@@ -7,11 +7,28 @@
 
 #define NUM_PORTS 6 // Define the number of ports for clarity
 #define STABILIZATION_DELAY 500 // Delay in milliseconds for state stabilization
+#define SAMPLE_PERIOD 20 // Delay in milliseconds between two samples of the ports
 #define COLOR_MSG 1 // Define message type for color message
+#define STATS_QUERY_MSG 11 // Stats query, the grid block receiving it collects the stats of the grid
+#define REPEAT_WINDOW 3000 // Reattaching a side within this many ms selects its blinking color
+#define BLINK_PERIOD 500 // ms between two phases of a blinking color, as on the grid blocks
+
+// Debounce state of a port
+enum { PORT_STABLE, PORT_SETTLING };
 
 uint8_t neighborStates[NUM_PORTS] = {0}; // Track the state of all 6 ports (0 = disconnected, 1 = connected)
+uint8_t debounceStates[NUM_PORTS] = {0}; // PORT_SETTLING while the raw state differs from neighborStates
 uint32_t time = 0, treatmentTime = 0;
-uint32_t lastEventTime[NUM_PORTS] = {0}; // Track the last event time for each port
+uint32_t lastEventTime[NUM_PORTS] = {0}; // Track when each port started settling
+uint32_t lastAttachTime[NUM_PORTS] = {0}; // When each port last got a neighbor, 0 if never
+uint8_t portBank[NUM_PORTS] = {0}; // 1 while a side selects its blinking color
+uint8_t shownColor = 0; // Color index shown on the LED, 0 for none (WHITE)
+uint32_t blinkTime = 0;
+uint8_t statsQueryId = 0; // ID of the last stats query sent
+uint8_t blinkPhase = 0;
+
+// LED color of each color index 1..9, as on the grid blocks: 1 to 4 steady, 5 to 9 blinking
+const uint8_t colorLeds[9] = { GREEN, BLUE, ORANGE, RED, GREEN, BLUE, ORANGE, RED, WHITE };
 
 // Function to send a message to a specific port
 void sendMessageToPort(uint8_t port, uint8_t messageType, uint8_t color) {
@@ -22,33 +39,74 @@ void sendMessageToPort(uint8_t port, uint8_t messageType, uint8_t color) {
 }
 enum direction { NORTH, BOTTOM, WEST,EAST,SOUTH,TOP};
 
-// Map the port to the direction and associated color
-void handleNewNeighbor(uint8_t port, uint8_t isConnected) {
-    uint8_t color;
+// A quick reattach of TOP or BOTTOM asks for the stats instead of entering a color
+uint8_t portQueriesStats(uint8_t port) {
+    return (port == TOP || port == BOTTOM) && portBank[port];
+}
 
-    // Determine the color for the new connection
+// Map the port to the color index it enters: a side gives 1 to 4, or 5 to 8 when reattached
+// quickly (portBank), TOP and BOTTOM give 9
+uint8_t portColor(uint8_t port) {
+    if (portQueriesStats(port)) {
+        return 0; // Shown as WHITE
+    }
     switch (port) {
         case 0: // NORTH
-            color = GREEN;
-            break;
+            return 1 + 4 * portBank[port]; // GREEN
         case 2: // WEST
-            color = RED;
-            break;
+            return 4 + 4 * portBank[port]; // RED
         case 3: // EAST
-            color = ORANGE;
-            break;
+            return 3 + 4 * portBank[port]; // ORANGE
         case 4: // SOUTH
-            color = BLUE;
-            break;
+            return 2 + 4 * portBank[port]; // BLUE
         default:
-            color = BLACK;
-            break;
+            return 9; // Blinking WHITE
     }
+}
 
-    // Send a message and update the LED color only on connection
-    if (isConnected) {
-        sendMessageToPort(port, COLOR_MSG, color); // Encapsulate and send message
-        setColor(color); // Update the LED color
+void showColor(uint8_t color) {
+    shownColor = color;
+    if (color == 0) {
+        setColor(WHITE);
+    } else {
+        setColor((color > 4 && blinkPhase) ? BLACK : colorLeds[color - 1]);
+    }
+}
+
+// Handle every port that settled during one pass, with a single LED update
+void handleNeighborChanges(uint8_t connectedMask, uint8_t disconnectedMask) {
+    uint8_t lastConnected = NUM_PORTS;
+
+    // Send a message to each new neighbor
+    for (uint8_t port = 0; port < NUM_PORTS; port++) {
+        if (connectedMask & (1 << port)) {
+            // A quick reattach of the same side toggles between its steady and blinking color
+            if (lastAttachTime[port] != 0 && time - lastAttachTime[port] < REPEAT_WINDOW) {
+                portBank[port] = !portBank[port];
+            } else {
+                portBank[port] = 0;
+            }
+            lastAttachTime[port] = time;
+            if (portQueriesStats(port)) {
+                sendMessageToPort(port, STATS_QUERY_MSG, ++statsQueryId);
+            } else {
+                sendMessageToPort(port, COLOR_MSG, portColor(port)); // Encapsulate and send message
+            }
+            lastConnected = port;
+        }
+    }
+
+    if (lastConnected != NUM_PORTS) {
+        showColor(portColor(lastConnected)); // Update the LED color
+    } else if (disconnectedMask) {
+        // Show a neighbor that is still there, or go back to the default color
+        uint8_t color = 0;
+        for (uint8_t port = 0; port < NUM_PORTS; port++) {
+            if (neighborStates[port]) {
+                color = portColor(port);
+            }
+        }
+        showColor(color);
     }
 }
 
@@ -59,22 +117,39 @@ void BBinit() {
 
 void BBloop() {
     time = HAL_GetTick();
+    if (shownColor > 4 && time - blinkTime >= BLINK_PERIOD) {
+        blinkTime = time;
+        blinkPhase = !blinkPhase;
+        showColor(shownColor);
+    }
     if (time > treatmentTime) {
-        treatmentTime = time + 400;
+        treatmentTime = time + SAMPLE_PERIOD;
+        uint8_t connectedMask = 0, disconnectedMask = 0;
 
-        // Check each port for changes in connection status
+        // Run the debounce state machine of every port in the same pass
         for (uint8_t port = 0; port < NUM_PORTS; port++) {
             uint8_t isConnected = is_connected(port); // Get the current connection status
 
-            // If the connection status has changed and stabilized
-            if (neighborStates[port] != isConnected &&
-                time > lastEventTime[port] + STABILIZATION_DELAY) {
+            if (neighborStates[port] == isConnected) {
+                debounceStates[port] = PORT_STABLE; // Back to the known state: it was a glitch
+            } else if (debounceStates[port] == PORT_STABLE) {
+                debounceStates[port] = PORT_SETTLING;
+                lastEventTime[port] = time;
+            } else if (time - lastEventTime[port] >= STABILIZATION_DELAY) {
+                // The connection status has changed and stabilized
                 neighborStates[port] = isConnected;
-                lastEventTime[port] = time; // Update event time
-                handleNewNeighbor(port, isConnected); // Handle the neighbor change
-                break; // Only handle one port change at a time
+                debounceStates[port] = PORT_STABLE;
+                if (isConnected) {
+                    connectedMask |= 1 << port;
+                } else {
+                    disconnectedMask |= 1 << port;
+                }
             }
         }
+
+        if (connectedMask || disconnectedMask) {
+            handleNeighborChanges(connectedMask, disconnectedMask);
+        }
     }
 }
 
@@ -85,7 +160,7 @@ uint8_t process_standard_packet(L3_packet *packet) {
     // Parse the received message
     uint8_t* data = packet->packet_content;
     uint8_t type = data[0]; // Extract message type
-    uint8_t color = data[1]; // Extract color
+    uint8_t color = data[1]; // Extract color index
 
     // Optionally handle received messages here (e.g., logging or reacting to messages)
 
@@ -0,0 +1,417 @@
+/**
+ * @file sudokuCore.h
+ * Protocol core shared by the Blinky Block firmware and the VisibleSim SudokuCode:
+ * message codecs, candidate domain, grid geometry and the check state machines.
+ * Plain C, header only, no allocation and no platform dependency; ports are small
+ * indexes (< 8) chosen by each adapter.
+ **/
+
+#ifndef SudokuCore_H_
+#define SudokuCore_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#define SC_PACKED __attribute__((packed))
+
+// Message types
+#define SC_COLOR_MSG 1
+#define SC_SETCOOR_MSG 2
+#define SC_HORIZONTAL_MSG 3
+#define SC_VERTICAL_MSG 4
+#define SC_DIAL_MSG 5
+#define SC_UPDATE_MSG 6
+#define SC_ACK_MSG 7
+#define SC_CANCEL_MSG 8
+#define SC_COOR_REQUEST_MSG 9
+#define SC_COOR_INVALIDATE_MSG 10
+#define SC_STATS_QUERY_MSG 11
+#define SC_STATS_REPORT_MSG 12
+#define SC_FRAME_MSG 13
+
+#define SC_NO_PORT 0xFF
+#define SC_PORT_BIT(p) ((uint8_t)(1u << (p)))
+#define SC_STATS_VALUES 8
+#define SC_FRAME_HEADER_SIZE 2
+
+// Checks a block can relay at once, for all initiators and types together
+#ifndef SC_NB_RELAYS
+#define SC_NB_RELAYS 24
+#endif
+
+// Abstract grid directions, mapped to real ports by each adapter
+enum { SC_DIR_XPLUS, SC_DIR_XMINUS, SC_DIR_YPLUS, SC_DIR_YMINUS, SC_NB_DIRS };
+#define SC_NO_DIR 0xFF
+
+// Results of the check state machines
+enum { SC_IGNORED, SC_PENDING, SC_ACCEPTED, SC_REJECTED };
+
+/*
+ * Messages. The first byte is always the type.
+ */
+
+// COLOR_MSG, UPDATE_MSG
+typedef struct SC_PACKED {
+    uint8_t type;
+    uint8_t color;
+} SC_ValueMessage;
+
+typedef struct SC_PACKED {
+    uint8_t type;
+    int16_t x;
+    int16_t y;
+    uint8_t hops;  // Distance of the sender to the root
+    uint8_t epoch; // Grid epoch of the sender
+} SC_SetCoorMessage;
+
+// HORIZONTAL_MSG, VERTICAL_MSG
+typedef struct SC_PACKED {
+    uint8_t type;
+    uint8_t color;
+    uint8_t seq;   // Check sequence number of the initiator
+    int16_t ox;    // Initiator coordinates, which key the relays
+    int16_t oy;
+} SC_ChainCheckMessage;
+
+typedef struct SC_PACKED {
+    uint8_t type;
+    uint8_t count; // Hops from the initiator
+    uint8_t color;
+    uint8_t seq;
+    int16_t ox;    // Initiator coordinates, to tell row/column relays from the cells to check
+    int16_t oy;
+} SC_DialCheckMessage;
+
+typedef struct SC_PACKED {
+    uint8_t type;
+    uint8_t processResponseType; // Type of the check (or SETCOOR_MSG) this answers
+    uint8_t isSuccess;
+    uint8_t color;
+    uint8_t seq;
+    int16_t ox;    // Initiator of the check answered
+    int16_t oy;
+} SC_AckMessage;
+
+// Sent downstream when a check already failed elsewhere, so relays stop waiting
+typedef struct SC_PACKED {
+    uint8_t type;
+    uint8_t processType;
+    uint8_t seq;
+    int16_t ox;
+    int16_t oy;
+} SC_CancelMessage;
+
+typedef struct SC_PACKED {
+    uint8_t type;
+    uint8_t epoch;
+} SC_CoorInvalidateMessage;
+
+typedef struct SC_PACKED {
+    uint8_t type;
+    uint8_t queryId;
+} SC_StatsQueryMessage;
+
+typedef struct SC_PACKED {
+    uint8_t type;
+    uint8_t queryId;
+    int16_t x;
+    int16_t y;
+    uint8_t section;
+    uint16_t values[SC_STATS_VALUES];
+} SC_StatsReportMessage;
+
+// Size of a message as sent, 0 for FRAME_MSG whose size depends on its content
+static inline uint8_t sc_message_size(uint8_t type) {
+    switch (type) {
+        case SC_SETCOOR_MSG: return sizeof(SC_SetCoorMessage);
+        case SC_HORIZONTAL_MSG:
+        case SC_VERTICAL_MSG: return sizeof(SC_ChainCheckMessage);
+        case SC_DIAL_MSG: return sizeof(SC_DialCheckMessage);
+        case SC_ACK_MSG: return sizeof(SC_AckMessage);
+        case SC_CANCEL_MSG: return sizeof(SC_CancelMessage);
+        case SC_COOR_REQUEST_MSG: return 1;
+        case SC_COOR_INVALIDATE_MSG: return sizeof(SC_CoorInvalidateMessage);
+        case SC_STATS_QUERY_MSG: return sizeof(SC_StatsQueryMessage);
+        case SC_STATS_REPORT_MSG: return sizeof(SC_StatsReportMessage);
+        case SC_FRAME_MSG: return 0;
+        default: return sizeof(SC_ValueMessage);
+    }
+}
+
+/*
+ * Frames: {FRAME_MSG, count, then size + bytes of each sub-message}
+ */
+
+// Append a message, starting the frame if empty; 0 if it does not fit
+static inline uint8_t sc_frame_append(uint8_t *frame, uint8_t *frameSize, uint8_t capacity,
+                                      const uint8_t *msg, uint8_t msgSize) {
+    uint8_t size = *frameSize ? *frameSize : SC_FRAME_HEADER_SIZE;
+    if (size + 1 + msgSize > capacity) {
+        return 0;
+    }
+    if (*frameSize == 0) {
+        frame[0] = SC_FRAME_MSG;
+        frame[1] = 0;
+    }
+    frame[size++] = msgSize;
+    memcpy(frame + size, msg, msgSize);
+    *frameSize = size + msgSize;
+    frame[1]++;
+    return 1;
+}
+
+// Walk the sub-messages of a frame; *offset starts at 0
+static inline uint8_t sc_frame_next(const uint8_t *frame, uint8_t frameSize, uint8_t *offset,
+                                    const uint8_t **msg, uint8_t *msgSize) {
+    if (*offset == 0) {
+        *offset = SC_FRAME_HEADER_SIZE;
+    }
+    if (*offset >= frameSize || *offset + 1 + frame[*offset] > frameSize) {
+        return 0;
+    }
+    *msgSize = frame[*offset];
+    *msg = frame + *offset + 1;
+    *offset += 1 + *msgSize;
+    return 1;
+}
+
+/*
+ * Candidate domain: bit v-1 set while value v is still possible
+ */
+
+typedef uint16_t sc_mask_t;
+
+#define SC_NO_VALUE 0
+#define SC_VALUE_BIT(v) ((sc_mask_t)(1u << ((v) - 1)))
+#define SC_ALL_VALUES(n) ((sc_mask_t)((1u << (n)) - 1))
+
+static inline uint8_t sc_count(sc_mask_t mask) {
+    return (uint8_t)__builtin_popcount(mask);
+}
+
+// The value left if exactly one candidate remains, SC_NO_VALUE otherwise
+static inline uint8_t sc_single_value(sc_mask_t mask) {
+    return sc_count(mask) == 1 ? (uint8_t)(__builtin_ctz(mask) + 1) : SC_NO_VALUE;
+}
+
+// Drop a candidate, never the last one; 1 if the mask changed
+static inline uint8_t sc_eliminate(sc_mask_t *mask, uint8_t value) {
+    if (sc_count(*mask) > 1 && (*mask & SC_VALUE_BIT(value))) {
+        *mask &= (sc_mask_t)~SC_VALUE_BIT(value);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Geometry: a row shares y, a column shares x, a box is boxWidth x boxHeight cells
+ */
+
+static inline uint8_t sc_same_box(int16_t ax, int16_t ay, int16_t bx, int16_t by,
+                                  uint8_t boxWidth, uint8_t boxHeight) {
+    return ax / boxWidth == bx / boxWidth && ay / boxHeight == by / boxHeight;
+}
+
+// Two distinct cells that must not hold the same value
+static inline uint8_t sc_is_peer(int16_t ax, int16_t ay, int16_t bx, int16_t by,
+                                 uint8_t boxWidth, uint8_t boxHeight) {
+    if (ax == bx && ay == by) {
+        return 0;
+    }
+    return ax == bx || ay == by || sc_same_box(ax, ay, bx, by, boxWidth, boxHeight);
+}
+
+static inline void sc_step(uint8_t dir, int16_t *x, int16_t *y) {
+    switch (dir) {
+        case SC_DIR_XPLUS: (*x)++; break;
+        case SC_DIR_XMINUS: (*x)--; break;
+        case SC_DIR_YPLUS: (*y)++; break;
+        case SC_DIR_YMINUS: (*y)--; break;
+        default: break;
+    }
+}
+
+static inline uint8_t sc_opposite_dir(uint8_t dir) {
+    return dir == SC_NO_DIR ? SC_NO_DIR : (uint8_t)(dir ^ 1);
+}
+
+// Is the cell one step away in `dir` inside the grid and in the same box?
+static inline uint8_t sc_step_in_box(int16_t x, int16_t y, uint8_t dir, uint8_t boxWidth, uint8_t boxHeight) {
+    int16_t nx = x, ny = y;
+    sc_step(dir, &nx, &ny);
+    return nx >= 0 && ny >= 0 && sc_same_box(x, y, nx, ny, boxWidth, boxHeight);
+}
+
+// The dial (box) check only tests the cells outside the initiator's row and column
+static inline uint8_t sc_dial_must_check(int16_t x, int16_t y, int16_t ox, int16_t oy) {
+    return x != ox && y != oy;
+}
+
+// Directions to forward a dial check to. The box is covered by a comb: along x on the
+// initiator's row, then along y from every row cell, so each cell is reached exactly once.
+// `fromDir` points back to the sender, SC_NO_DIR on the initiator.
+static inline uint8_t sc_dial_children(int16_t x, int16_t y, int16_t oy, uint8_t fromDir,
+                                       uint8_t boxWidth, uint8_t boxHeight) {
+    uint8_t dirs = 0;
+    for (uint8_t dir = 0; dir < SC_NB_DIRS; ++dir) {
+        uint8_t wanted;
+        if (fromDir == SC_NO_DIR) {
+            wanted = 1;
+        } else if (dir == sc_opposite_dir(fromDir)) {
+            wanted = 1; // Keep going straight
+        } else {
+            wanted = (y == oy) && (dir == SC_DIR_YPLUS || dir == SC_DIR_YMINUS) && dir != fromDir;
+        }
+        if (wanted && sc_step_in_box(x, y, dir, boxWidth, boxHeight)) {
+            dirs |= SC_PORT_BIT(dir);
+        }
+    }
+    return dirs;
+}
+
+/*
+ * Check state machines, with fail-fast: the first failure decides and the branches
+ * still in flight are to be cancelled (CANCEL_MSG on the returned ports).
+ */
+
+// A check initiated by this block
+typedef struct {
+    uint8_t active;
+    uint8_t type;         // VERTICAL_MSG, HORIZONTAL_MSG or DIAL_MSG
+    uint8_t seq;
+    uint8_t color;
+    uint8_t pendingPorts; // Ports whose answer is still awaited
+} SC_Check;
+
+// A check relayed on behalf of another block. Several initiators may check through the
+// same block at once, so relays are kept in a table keyed by type and initiator.
+typedef struct {
+    uint8_t active;
+    uint8_t type;
+    uint8_t seq;
+    int16_t ox;           // Initiator
+    int16_t oy;
+    uint8_t upPort;       // Port towards the initiator
+    uint8_t pendingPorts; // Downstream ports whose answer is still awaited
+    uint8_t color;
+} SC_Relay;
+
+// Stage run after `type` when it succeeds: vertical, horizontal, then dial; 0 when done
+static inline uint8_t sc_next_stage(uint8_t type) {
+    switch (type) {
+        case SC_VERTICAL_MSG: return SC_HORIZONTAL_MSG;
+        case SC_HORIZONTAL_MSG: return SC_DIAL_MSG;
+        default: return 0;
+    }
+}
+
+// Start a new check; returns the ports of a superseded check, to be cancelled
+static inline uint8_t sc_check_begin(SC_Check *check, uint8_t type, uint8_t color) {
+    uint8_t stale = check->active ? check->pendingPorts : 0;
+    check->active = 1;
+    check->type = type;
+    check->seq++;
+    check->color = color;
+    check->pendingPorts = 0;
+    return stale;
+}
+
+static inline void sc_check_expect(SC_Check *check, uint8_t port) {
+    check->pendingPorts |= SC_PORT_BIT(port);
+}
+
+// Nothing to wait for (no neighbor in that direction): accepted right away
+static inline uint8_t sc_check_started(SC_Check *check) {
+    if (check->pendingPorts == 0) {
+        check->active = 0;
+        return SC_ACCEPTED;
+    }
+    return SC_PENDING;
+}
+
+static inline uint8_t sc_check_answer(SC_Check *check, uint8_t type, uint8_t seq, uint8_t port,
+                                      uint8_t isSuccess, uint8_t *cancelPorts) {
+    *cancelPorts = 0;
+    if (!check->active || check->type != type || check->seq != seq
+        || !(check->pendingPorts & SC_PORT_BIT(port))) {
+        return SC_IGNORED;
+    }
+    check->pendingPorts &= (uint8_t)~SC_PORT_BIT(port);
+    if (!isSuccess) {
+        *cancelPorts = check->pendingPorts;
+        check->pendingPorts = 0;
+        check->active = 0;
+        return SC_REJECTED;
+    }
+    if (check->pendingPorts == 0) {
+        check->active = 0;
+        return SC_ACCEPTED;
+    }
+    return SC_PENDING;
+}
+
+// Active relay of an initiator's check of `type`, NULL if none
+static inline SC_Relay *sc_relay_find(SC_Relay *relays, uint8_t type, int16_t ox, int16_t oy) {
+    for (uint8_t i = 0; i < SC_NB_RELAYS; ++i) {
+        if (relays[i].active && relays[i].type == type && relays[i].ox == ox && relays[i].oy == oy) {
+            return &relays[i];
+        }
+    }
+    return NULL;
+}
+
+// Slot for a new relay: the one it supersedes, else a free one; NULL if the table is full
+static inline SC_Relay *sc_relay_slot(SC_Relay *relays, uint8_t type, int16_t ox, int16_t oy) {
+    SC_Relay *relay = sc_relay_find(relays, type, ox, oy);
+    for (uint8_t i = 0; !relay && i < SC_NB_RELAYS; ++i) {
+        if (!relays[i].active) {
+            relay = &relays[i];
+        }
+    }
+    return relay;
+}
+
+static inline void sc_relay_open(SC_Relay *relay, uint8_t type, uint8_t seq, int16_t ox, int16_t oy,
+                                 uint8_t upPort, uint8_t children, uint8_t color) {
+    relay->active = 1;
+    relay->type = type;
+    relay->seq = seq;
+    relay->ox = ox;
+    relay->oy = oy;
+    relay->upPort = upPort;
+    relay->pendingPorts = children;
+    relay->color = color;
+}
+
+// SC_ACCEPTED / SC_REJECTED: answer the initiator (relay->upPort) now
+static inline uint8_t sc_relay_answer(SC_Relay *relay, uint8_t seq, uint8_t port, uint8_t isSuccess,
+                                      uint8_t *cancelPorts) {
+    *cancelPorts = 0;
+    if (!relay || !relay->active || relay->seq != seq || !(relay->pendingPorts & SC_PORT_BIT(port))) {
+        return SC_IGNORED; // Stale answer of a cancelled or finished check
+    }
+    relay->pendingPorts &= (uint8_t)~SC_PORT_BIT(port);
+    if (!isSuccess) {
+        *cancelPorts = relay->pendingPorts;
+        relay->pendingPorts = 0;
+    }
+    if (relay->pendingPorts == 0) {
+        relay->active = 0;
+        return isSuccess ? SC_ACCEPTED : SC_REJECTED;
+    }
+    return SC_PENDING;
+}
+
+// 1 if the cancel applies: pass it on to *cancelPorts
+static inline uint8_t sc_relay_cancel(SC_Relay *relay, uint8_t seq, uint8_t fromPort, uint8_t *cancelPorts) {
+    *cancelPorts = 0;
+    if (!relay || !relay->active || relay->seq != seq || relay->upPort != fromPort) {
+        return 0;
+    }
+    *cancelPorts = relay->pendingPorts;
+    relay->active = 0;
+    relay->pendingPorts = 0;
+    return 1;
+}
+
+#endif /* SudokuCore_H_ */
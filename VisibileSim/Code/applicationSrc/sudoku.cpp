@@ -9,6 +9,8 @@
  
 #include <iostream>
 #include "sudokuCode.hpp"
+#include "sudokuTrace.hpp"
+#include "sudokuLoad.hpp"
 
 using namespace std;
 using namespace SmartBlocks;
@@ -18,7 +20,12 @@ int main(int argc, char **argv) {
         createSimulator(argc, argv, SudokuCode::buildNewBlockCode);
         getSimulator()->printInfo();
         BaseSimulator::getWorld()->printInfo();
+        cout << SudokuLoad::report();
+#ifdef SUDOKU_PROFILE
+        cout << "Handler profile (all blocks):\n" << SudokuProfile::global().report();
+#endif
         deleteSimulator();
+        SudokuTrace::close();
     } catch(std::exception const& e) {
         cerr << "Uncaught exception: " << e.what();
     }
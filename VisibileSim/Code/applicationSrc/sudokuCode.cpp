@@ -1,34 +1,44 @@
 #include "sudokuCode.hpp"
+#include "sudokuTrace.hpp"
+#include "sudokuVisuals.hpp"
+#include "sudokuLoad.hpp"
 #include <unordered_map>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
 
 // Static member initialization
-std::vector<SmartBlocksBlock*> SudokuCode::allBlocks;
-std::unordered_map<int, int> SudokuCode::blockValues;
+std::unordered_map<int, SudokuPuzzle> SudokuCode::puzzles;
+int SudokuCode::nextComponentId = -2;
+std::mutex SudokuCode::membershipLock;
 
 // Constructor
 SudokuCode::SudokuCode(SmartBlocksBlock *host) : SmartBlocksBlockCode(host), module(host) {
     if (!host) return;
+    rng.seed(host->blockId);
 }
 
 // Startup function called when the block is initialized
 void SudokuCode::startup() {
+    SUDOKU_PROFILE_SCOPE(PROF_STARTUP);
+    SudokuVisuals::Batch batch;
     console << "start " << getId() << "\n";
 
-    // Add the current block to the list of all blocks
-    allBlocks.push_back(module);
+    // Add the current block to its puzzle
+    joinPuzzle();
 
-    // Get the initial value for the block
-    int value = blockValues[getId()];
+    // The initial value, published in the grid with those of the whole puzzle by joinPuzzle
+    int value = initialValue;
     if (value > 0) {
-        module->setDisplayedValue(value); // Set the displayed value
-        setColor(GREEN); // Set color to green if value is set
+        SudokuVisuals::setValue(module, value); // Set the displayed value
+        SudokuVisuals::setColor(module, GREEN); // Set color to green if value is set
     } else {
-        setColor(WHITE); // Set color to white if no value is set
+        SudokuVisuals::setColor(module, WHITE); // Set color to white if no value is set
     }
 
     // Check for conflicts and set color to red if any
     if (hasConflict()) {
-        setColor(RED);
+        SudokuVisuals::setColor(module, RED);
     }
 
     // Register message handlers
@@ -36,127 +46,39 @@ void SudokuCode::startup() {
     addMessageEventFunc2(COL_CHECK_MSG_ID, std::bind(&SudokuCode::handleColumnCheckMessage, this, std::placeholders::_1, std::placeholders::_2));
     addMessageEventFunc2(BOX_CHECK_MSG_ID, std::bind(&SudokuCode::handleBoxCheckMessage, this, std::placeholders::_1, std::placeholders::_2));
     addMessageEventFunc2(SOLUTION_FOUND_MSG_ID, std::bind(&SudokuCode::handleSolutionFoundMessage, this, std::placeholders::_1, std::placeholders::_2));
+    addMessageEventFunc2(SOLVER_VALUE_MSG_ID, std::bind(&SudokuCode::handleSolverValueMessage, this, std::placeholders::_1, std::placeholders::_2));
+
+    // The first block hosts the synthetic load generator, if enabled
+    if (SudokuLoad::addBlock(getId(), this)) {
+        scheduleLoadTick();
+    }
 }
 
-// Check if the current block has any conflicts
+// Check if the current block has any conflicts, from the values of its peers
 bool SudokuCode::hasConflict() {
-    int value = blockValues[getId()];
+    SUDOKU_PROFILE_SCOPE(PROF_HAS_CONFLICT);
+    int value = valueOf(module);
     if (value == 0) return false;  // No conflict if the block is empty
 
-    bool conflict = false;
-
-    // Check for conflicts in the same row
-    for (int dir = 0; dir < SLattice::Direction::MAX_NB_NEIGHBORS; ++dir) {
-        auto interface = module->getInterface(static_cast<SLattice::Direction>(dir));
-        if (interface && interface->connectedInterface) {
-            auto neighbor = dynamic_cast<SmartBlocksBlock*>(interface->connectedInterface->hostBlock);
-            if (neighbor && neighbor->position[0] == module->position[0]) { // Same row
-                auto rowCheckMsg = new MessageOf<int>(ROW_CHECK_MSG_ID, module->position[0]);
-                sendMessage("RowCheck", rowCheckMsg, interface, 100, 200);
-
-                // Implement a callback mechanism to handle the response
-                addMessageEventFunc2(ROW_CHECK_MSG_ID, [this, &conflict](std::shared_ptr<Message> _msg, P2PNetworkInterface *sender) {
-                    bool isValid = *static_cast<MessageOf<bool>*>(_msg.get())->getData();
-                    if (!isValid) {
-                        conflict = true;
-                        highlightConflicts(module);
-                    }
-                });
-            }
-        }
-    }
-
-    // Check for conflicts in the same column
-    for (int dir = 0; dir < SLattice::Direction::MAX_NB_NEIGHBORS; ++dir) {
-        auto interface = module->getInterface(static_cast<SLattice::Direction>(dir));
-        if (interface && interface->connectedInterface) {
-            auto neighbor = dynamic_cast<SmartBlocksBlock*>(interface->connectedInterface->hostBlock);
-            if (neighbor && neighbor->position[1] == module->position[1]) { // Same column
-                auto colCheckMsg = new MessageOf<int>(COL_CHECK_MSG_ID, module->position[1]);
-                sendMessage("ColumnCheck", colCheckMsg, interface, 100, 200);
-
-                // Implement a callback mechanism to handle the response
-                addMessageEventFunc2(COL_CHECK_MSG_ID, [this, &conflict](std::shared_ptr<Message> _msg, P2PNetworkInterface *sender) {
-                    bool isValid = *static_cast<MessageOf<bool>*>(_msg.get())->getData();
-                    if (!isValid) {
-                        conflict = true;
-                        highlightConflicts(module);
-                    }
-                });
-            }
-        }
-    }
-
-    // Check for conflicts in the same 3x3 region
-    int startX = module->position[0] / 3 * 3;
-    int startY = module->position[1] / 3 * 3;
-    for (int dir = 0; dir < SLattice::Direction::MAX_NB_NEIGHBORS; ++dir) {
-        auto interface = module->getInterface(static_cast<SLattice::Direction>(dir));
-        if (interface && interface->connectedInterface) {
-            auto neighbor = dynamic_cast<SmartBlocksBlock*>(interface->connectedInterface->hostBlock);
-            int neighborX = neighbor->position[0];
-            int neighborY = neighbor->position[1];
-            if ((neighborX / 3 == startX / 3) && (neighborY / 3 == startY / 3)) { // Same 3x3 region
-                auto boxCheckMsg = new MessageOf<int>(BOX_CHECK_MSG_ID, (startX / 3) * 3 + (startY / 3));
-                sendMessage("BoxCheck", boxCheckMsg, interface, 100, 200);
-
-                // Implement a callback mechanism to handle the response
-                addMessageEventFunc2(BOX_CHECK_MSG_ID, [this, &conflict](std::shared_ptr<Message> _msg, P2PNetworkInterface *sender) {
-                    bool isValid = *static_cast<MessageOf<bool>*>(_msg.get())->getData();
-                    if (!isValid) {
-                        conflict = true;
-                        highlightConflicts(module);
-                    }
-                });
-            }
-        }
-    }
+    return blockHasConflict(module);
+}
 
-    return conflict;
+// Any peer of the block holds the same value, read lock-free from the grid
+bool SudokuCode::blockHasConflict(SmartBlocksBlock *block) {
+    return grid()->peerHolds(localX(block), localY(block), valueOf(block));
 }
 
 // Find candidate values for a given block
 std::vector<int> SudokuCode::findCandidates(SmartBlocksBlock* block) {
-    std::set<int> takenValues;
-
-    // Check values in the same row
-    for (auto neighbor : getNeighbors(block)) {
-        if (neighbor->position[0] == block->position[0]) {
-            int neighborValue = blockValues[neighbor->blockId];
-            if (neighborValue > 0) {
-                takenValues.insert(neighborValue);
-            }
-        }
-    }
-
-    // Check values in the same column
-    for (auto neighbor : getNeighbors(block)) {
-        if (neighbor->position[1] == block->position[1]) {
-            int neighborValue = blockValues[neighbor->blockId];
-            if (neighborValue > 0) {
-                takenValues.insert(neighborValue);
-            }
-        }
-    }
-
-    // Check values in the same 3x3 region
-    int startX = block->position[0] / 3 * 3;
-    int startY = block->position[1] / 3 * 3;
-    for (auto neighbor : getNeighbors(block)) {
-        int neighborX = neighbor->position[0];
-        int neighborY = neighbor->position[1];
-        if ((neighborX / 3 == startX / 3) && (neighborY / 3 == startY / 3)) {
-            int neighborValue = blockValues[neighbor->blockId];
-            if (neighborValue > 0) {
-                takenValues.insert(neighborValue);
-            }
-        }
-    }
+    SUDOKU_PROFILE_SCOPE(PROF_FIND_CANDIDATES);
+    // Values taken in the same row, column or box (grids can exceed the 16 values of sc_mask_t)
+    std::vector<bool> taken(nbValues() + 1, false);
+    grid()->markTaken(localX(block), localY(block), taken);
 
     // Generate the list of candidate values
     std::vector<int> candidates;
-    for (int i = 1; i <= 9; ++i) {
-        if (takenValues.find(i) == takenValues.end()) {
+    for (int i = 1; i <= nbValues(); ++i) {
+        if (!taken[i]) {
             candidates.push_back(i);
         }
     }
@@ -166,18 +88,13 @@ std::vector<int> SudokuCode::findCandidates(SmartBlocksBlock* block) {
 // Get the neighboring blocks of a given block
 std::vector<SmartBlocksBlock*> SudokuCode::getNeighbors(SmartBlocksBlock* block) {
     std::vector<SmartBlocksBlock*> neighbors;
-    int x = block->position[0];
-    int y = block->position[1];
-
-    // Add neighbors in the 9x9 grid
-    for (auto otherBlock : allBlocks) {
-        int otherX = otherBlock->position[0];
-        int otherY = otherBlock->position[1];
-
-        // Same row, same column, or same 3x3 sub-grid
-        if ((otherX == x || otherY == y ||
-             (otherX / 3 == x / 3 && otherY / 3 == y / 3)) &&
-            otherBlock != block) {
+    int x = localX(block);
+    int y = localY(block);
+
+    // Same row, same column, or same 3x3 sub-grid of the same puzzle
+    for (auto otherBlock : puzzle()->blocks) {
+        if (otherBlock != block && sc_is_peer(x, y, localX(otherBlock), localY(otherBlock),
+                                              puzzle()->boxSize, puzzle()->boxSize)) {
             neighbors.push_back(otherBlock);
         }
     }
@@ -186,55 +103,96 @@ std::vector<SmartBlocksBlock*> SudokuCode::getNeighbors(SmartBlocksBlock* block)
 
 // Highlight conflicts for a given block
 void SudokuCode::highlightConflicts(SmartBlocksBlock* block) {
+    SUDOKU_PROFILE_SCOPE(PROF_HIGHLIGHT_CONFLICTS);
     for (auto neighbor : getNeighbors(block)) {
-        if (blockValues[neighbor->blockId] == blockValues[block->blockId]) {
-            neighbor->setColor(RED);
+        if (valueOf(neighbor) == valueOf(block)) {
+            scheduleOn(neighbor, MARK_CONFLICT_ID, getScheduler()->now()); // Each block paints itself
         }
     }
-    block->setColor(GREEN);
+    SudokuVisuals::setColor(block, GREEN);
 }
 
 // Derive values for blocks with only one possible candidate
 void SudokuCode::deriveValues() {
-    for (auto block : allBlocks) {
-        if (blockValues[block->blockId] == 0) { // If the block is empty
+    SUDOKU_PROFILE_SCOPE(PROF_DERIVE_VALUES);
+    if (puzzle()->strategy == STRATEGY_MIN_CONFLICTS) {
+        // Every block announces its value, in its own event; the empty ones start searching
+        puzzle()->solving = true;
+        puzzle()->timing = true;
+        puzzle()->solverMoves = 0;
+        puzzle()->solverStart = getScheduler()->now();
+        for (auto block : puzzle()->blocks) {
+            scheduleOn(block, SOLVER_START_ID, getScheduler()->now());
+        }
+        scheduleOn(module, VALIDATED_ID, getScheduler()->now() + 1);
+        return;
+    }
+    if (!puzzle()->timing.exchange(true)) { // First pass of a naked-singles run
+        puzzle()->solverMoves = 0;
+        puzzle()->solverStart = getScheduler()->now();
+    }
+    // Each single is sent to its block, which writes its own cell only if still empty, so a
+    // derivation never overwrites an edit made since
+    bool derived = false;
+    for (auto block : puzzle()->blocks) {
+        if (valueOf(block) == 0) { // If the block is empty
             std::vector<int> candidates = findCandidates(block);
             if (candidates.size() == 1) {
-                blockValues[block->blockId] = candidates[0];
-                block->setDisplayedValue(candidates[0]);
-                block->setColor(YELLOW); // Mark derived cells in yellow
+                scheduleOn(block, DERIVED_VALUE_ID + candidates[0], getScheduler()->now());
+                derived = true;
             }
         }
     }
+    if (derived) {
+        scheduleOn(module, DERIVE_ID, getScheduler()->now() + 1); // Next pass, once the singles are in
+    } else {
+        finalizeGrid(); // Timed as min-conflicts is: reported once the grid is solved
+        scheduleOn(module, VALIDATED_ID, getScheduler()->now() + 1); // After the solved colors
+    }
+}
+
+// Take a naked single derived for this block, unless the cell was filled meanwhile
+void SudokuCode::applyDerivedValue(int value) {
+    if (valueOf(module) != 0) return;
+    publishValue(module, value);
+    SudokuVisuals::setValue(module, value);
+    SudokuVisuals::setColor(module, YELLOW); // Mark derived cells in yellow
+    puzzle()->solverMoves++;
 }
 
 // Update the value of the current block based on user input
 void SudokuCode::updateValue(char input) {
-    int currentValue = blockValues[getId()];
+    int currentValue = valueOf(module);
     if (input == '<') {
-        currentValue = (currentValue == 1) ? 9 : currentValue - 1;
+        currentValue = (currentValue <= 1) ? nbValues() : currentValue - 1;
     } else if (input == '>') {
-        currentValue = (currentValue == 9) ? 1 : currentValue + 1;
+        currentValue = (currentValue >= nbValues()) ? 1 : currentValue + 1;
+    }
+    publishValue(module, currentValue);
+    tentative = false; // The user's value is fixed for the solver
+    if (puzzle()->solving) {
+        announceValue();
+        refreshConflict();
     }
-    blockValues[getId()] = currentValue;
-    module->setDisplayedValue(currentValue);
-    setColor(CYAN);
+    SudokuVisuals::setValue(module, currentValue);
+    SudokuVisuals::setColor(module, CYAN);
 }
 
-// Validate the value of the current block
+// Validate the value of the current block: column, row then box check over the network
 void SudokuCode::validateValue() {
-    if (hasConflict()) {
-        highlightConflicts(module);  // Highlight all conflicting blocks
-    } else {
-        setColor(BLACK); // If the value is valid, set color to black
-        deriveValues();  // Trigger automatic derivations
+    SudokuLoad::validationStarted(getId(), getScheduler()->now());
+    int value = valueOf(module);
+    if (value == 0) {
+        finishCheck(true); // Nothing to check
+        return;
     }
+    startCheck(SC_VERTICAL_MSG, value);
 }
 
 // Check if the Sudoku grid is complete and valid
 bool SudokuCode::isComplete() {
-    for (auto block : allBlocks) {
-        if (blockValues[block->blockId] == 0 || hasConflict()) {
+    for (auto block : puzzle()->blocks) {
+        if (valueOf(block) == 0 || blockHasConflict(block)) {
             return false;
         }
     }
@@ -244,8 +202,18 @@ bool SudokuCode::isComplete() {
 // Finalize the grid by setting all blocks to green if complete
 void SudokuCode::finalizeGrid() {
     if (isComplete()) {
-        for (auto block : allBlocks) {
-            block->setColor(GREEN);
+        for (auto block : puzzle()->blocks) {
+            if (block == module) {
+                SudokuVisuals::setColor(module, GREEN);
+            } else {
+                scheduleOn(block, MARK_SOLVED_ID, getScheduler()->now()); // Each block paints itself
+            }
+        }
+        puzzle()->solving = false;
+        if (puzzle()->timing.exchange(false)) { // Reported once, by the first block to see it
+            console << (puzzle()->strategy == STRATEGY_MIN_CONFLICTS ? "min-conflicts" : "naked singles")
+                    << ": puzzle " << puzzle()->id << " solved in " << puzzle()->solverMoves << " moves, "
+                    << (getScheduler()->now() - puzzle()->solverStart) << " us\n";
         }
     }
 }
@@ -254,14 +222,28 @@ void SudokuCode::finalizeGrid() {
 void SudokuCode::parseUserBlockElements(TiXmlElement *config) {
     int value;
     if (config->QueryIntAttribute("value", &value) == TIXML_SUCCESS) {
-        blockValues[getId()] = value;
+        initialValue = value;
     } else {
-        blockValues[getId()] = 0; // Initialize to 0 if no value is specified
+        initialValue = 0; // Initialize to 0 if no value is specified
+    }
+    int puzzleId;
+    if (config->QueryIntAttribute("puzzle", &puzzleId) == TIXML_SUCCESS && puzzleId >= 0) {
+        configPuzzleId = puzzleId;
+    }
+    int boxSize;
+    if (config->QueryIntAttribute("boxSize", &boxSize) == TIXML_SUCCESS && boxSize >= 2 && boxSize <= 15) {
+        configBoxSize = boxSize;
+    }
+    const char *solver = config->Attribute("solver");
+    if (solver) {
+        configStrategy = (std::string(solver) == "minconflicts") ? STRATEGY_MIN_CONFLICTS : STRATEGY_NAKED_SINGLES;
     }
 }
 
 // Handle user key presses
 void SudokuCode::onUserKeyPressed(unsigned char c, int x, int y) {
+    SudokuVisuals::startInteraction();
+    SudokuVisuals::Batch batch;
     switch (c) {
         case 'a':  // Left arrow key
             updateValue('<');
@@ -275,6 +257,22 @@ void SudokuCode::onUserKeyPressed(unsigned char c, int x, int y) {
         case 'f':
             finalizeGrid();
             break;
+        case 'm':  // Switch the solving strategy of the puzzle and run it
+            puzzle()->strategy = (puzzle()->strategy == STRATEGY_MIN_CONFLICTS) ? STRATEGY_NAKED_SINGLES
+                                                                            : STRATEGY_MIN_CONFLICTS;
+            console << "strategy: " << (puzzle()->strategy == STRATEGY_MIN_CONFLICTS ? "min-conflicts" : "naked singles") << "\n";
+            if (puzzle()->strategy == STRATEGY_NAKED_SINGLES) {
+                // Each block drops its tentative value in its own event, before the derivation runs
+                puzzle()->solving = false;
+                puzzle()->timing = false; // The naked-singles run is timed from its first pass
+                for (auto block : puzzle()->blocks) {
+                    scheduleOn(block, SOLVER_STOP_ID, getScheduler()->now());
+                }
+                scheduleOn(module, DERIVE_ID, getScheduler()->now() + 1);
+            } else {
+                deriveValues();
+            }
+            break;
         default:
             break;
     }
@@ -287,63 +285,412 @@ void SudokuCode::onBlockSelected() {
 
 // Draw the interface for the Sudoku module
 string SudokuCode::onInterfaceDraw() {
-    return "Sudoku Module\nID: " + std::to_string(getId());
+    SudokuVisuals::Stats visuals = SudokuVisuals::interactionStats();
+    std::string text = "Sudoku Module\nID: " + std::to_string(getId())
+        + "\nRender changes since last key: " + std::to_string(visuals.changes)
+        + " (" + std::to_string(visuals.dropped()) + " redundant writes dropped)"
+        + "\nStrategy: " + (puzzle()->strategy == STRATEGY_MIN_CONFLICTS ? "min-conflicts" : "naked singles")
+        + (puzzle()->solving ? ", " + std::to_string(puzzle()->conflictingBlocks) + " blocks in conflict" : "");
+#ifdef SUDOKU_PROFILE
+    text += "\n" + profile.report();
+#endif
+    return text;
 }
 
 // Handle row check message
 void SudokuCode::handleRowCheckMessage(std::shared_ptr<Message> _msg, P2PNetworkInterface *sender) {
-    auto data = *static_cast<MessageOf<int>*>(_msg.get())->getData();
-    int row = data;
+    SUDOKU_PROFILE_SCOPE(PROF_ROW_CHECK);
+    SudokuVisuals::Batch batch;
+    processCorePacket(_msg, sender);
+}
 
-    bool isValid = true;
-    for (auto block : allBlocks) {
-        if (block->position[0] == row && hasConflict()) {
-            isValid = false;
-            break;
+// Handle column check message
+void SudokuCode::handleColumnCheckMessage(std::shared_ptr<Message> _msg, P2PNetworkInterface *sender) {
+    SUDOKU_PROFILE_SCOPE(PROF_COLUMN_CHECK);
+    SudokuVisuals::Batch batch;
+    processCorePacket(_msg, sender);
+}
+
+// Handle box check message
+void SudokuCode::handleBoxCheckMessage(std::shared_ptr<Message> _msg, P2PNetworkInterface *sender) {
+    SUDOKU_PROFILE_SCOPE(PROF_BOX_CHECK);
+    SudokuVisuals::Batch batch;
+    processCorePacket(_msg, sender);
+}
+
+// Handle solution found message
+void SudokuCode::handleSolutionFoundMessage(std::shared_ptr<Message> _msg, P2PNetworkInterface *sender) {
+    SUDOKU_PROFILE_SCOPE(PROF_SOLUTION_FOUND);
+    // Handle solution found message
+}
+
+// Block of the same puzzle connected on a port, nullptr if none
+SmartBlocksBlock* SudokuCode::neighborAt(uint8_t port) {
+    auto interface = module->getInterface(static_cast<SLattice::Direction>(port));
+    if (!interface || !interface->connectedInterface) return nullptr;
+    auto neighbor = dynamic_cast<SmartBlocksBlock*>(interface->connectedInterface->hostBlock);
+    SudokuCode *code = neighbor ? codeOf(neighbor) : nullptr;
+    return (code && code->puzzle() == puzzle()) ? neighbor : nullptr;
+}
+
+// SudokuCode running on a block
+SudokuCode *SudokuCode::codeOf(SmartBlocksBlock *block) {
+    return dynamic_cast<SudokuCode*>(block->blockCode);
+}
+
+// Find the puzzle of this block. The first startup partitions the whole world at once, so
+// puzzles never grow or merge once blocks run: origins, extents and grids stay fixed. The
+// other startups wait on the lock meanwhile, and no block handles a message before its startup.
+void SudokuCode::joinPuzzle() {
+    std::lock_guard<std::mutex> lock(membershipLock);
+    if (puzzle()) return; // Assigned by an earlier startup
+    // First startup of the run, or a block added to the world since: take every block not
+    // assigned yet
+    std::vector<SmartBlocksBlock*> unassigned;
+    for (auto &entry : BaseSimulator::getWorld()->buildingBlocksMap) {
+        auto block = dynamic_cast<SmartBlocksBlock*>(entry.second);
+        SudokuCode *code = block ? codeOf(block) : nullptr;
+        if (code && !code->puzzle()) unassigned.push_back(block);
+    }
+    buildPuzzles(unassigned);
+}
+
+// Group blocks into new puzzles: by `puzzle` attribute, or else by connected component. Each
+// puzzle gets its origin (lowest position), box size, strategy and a grid holding every
+// initial value, so the startup checks see the whole grid whatever order blocks start in.
+// Blocks only see their puzzle once it is complete: running blocks of other puzzles may read
+// their currentPuzzle at any time (neighborAt).
+void SudokuCode::buildPuzzles(const std::vector<SmartBlocksBlock*> &blocks) {
+    std::vector<SudokuPuzzle*> built;
+    std::unordered_map<int, SudokuPuzzle*> byAttribute; // Puzzles of this pass, by `puzzle` ID
+    std::unordered_map<SudokuCode*, SudokuPuzzle*> assigned; // Blocks of this pass, by code
+    for (auto block : blocks) {
+        SudokuCode *code = codeOf(block);
+        if (assigned.count(code)) continue; // Reached through its component
+        int id = code->configPuzzleId;
+        if (id >= 0 && byAttribute.count(id)) {
+            assigned[code] = byAttribute[id];
+            byAttribute[id]->blocks.push_back(block);
+            continue;
+        }
+        if (id >= 0 && puzzles.count(id)) {
+            // Puzzle `id` already runs and must not change under its handlers
+            std::cerr << "sudoku: block " << block->blockId << " joins puzzle " << id
+                      << " after it started; it gets a puzzle of its own\n";
+            id = -1;
+        }
+        bool component = id < 0;
+        if (component) id = nextComponentId--;
+        SudokuPuzzle *p = &puzzles[id];
+        p->id = id;
+        built.push_back(p);
+        assigned[code] = p;
+        p->blocks.push_back(block);
+        if (!component) {
+            byAttribute[id] = p;
+            continue;
+        }
+        // Connected component: every block reached without a `puzzle` attribute
+        for (size_t next = p->blocks.size() - 1; next < p->blocks.size(); ++next) {
+            SmartBlocksBlock *current = p->blocks[next];
+            for (int dir = 0; dir < SLattice::Direction::MAX_NB_NEIGHBORS; ++dir) {
+                auto interface = current->getInterface(static_cast<SLattice::Direction>(dir));
+                if (!interface || !interface->connectedInterface) continue;
+                auto neighbor = dynamic_cast<SmartBlocksBlock*>(interface->connectedInterface->hostBlock);
+                SudokuCode *neighborCode = neighbor ? codeOf(neighbor) : nullptr;
+                if (neighborCode && !neighborCode->puzzle() && !assigned.count(neighborCode)
+                    && neighborCode->configPuzzleId < 0) {
+                    assigned[neighborCode] = p;
+                    p->blocks.push_back(neighbor);
+                }
+            }
         }
     }
 
-    auto responseMsg = new MessageOf<bool>(ROW_CHECK_MSG_ID, isValid);
-    sendMessage("RowCheckResponse", responseMsg, sender, 100, 200);
+    for (auto p : built) {
+        int maxX = INT_MIN, maxY = INT_MIN;
+        for (auto block : p->blocks) {
+            SudokuCode *code = codeOf(block);
+            p->originX = std::min<int>(p->originX, block->position[0]);
+            p->originY = std::min<int>(p->originY, block->position[1]);
+            maxX = std::max<int>(maxX, block->position[0]);
+            maxY = std::max<int>(maxY, block->position[1]);
+            if (code->configBoxSize) p->boxSize = code->configBoxSize;
+            if (code->configStrategy >= 0) p->strategy = static_cast<SudokuStrategy>(code->configStrategy);
+        }
+        int width = maxX - p->originX + 1, height = maxY - p->originY + 1;
+        int size = p->boxSize * p->boxSize;
+        if (p->id < 0 && (width > size || height > size)) {
+            // Rows and columns would run across both grids
+            std::cerr << "sudoku: connected blocks span " << width << "x" << height << " cells, more than one "
+                      << size << "x" << size << " grid: grids that touch need a `puzzle` attribute\n";
+        }
+        p->grid.reset(new SudokuGridState(p->boxSize, std::max(width, size), std::max(height, size)));
+        for (auto block : p->blocks) {
+            p->grid->publish(block->position[0] - p->originX, block->position[1] - p->originY,
+                             codeOf(block)->initialValue);
+        }
+    }
+    for (auto &entry : assigned) {
+        entry.first->currentPuzzle.store(entry.second, std::memory_order_release);
+    }
 }
 
-// Handle column check message
-void SudokuCode::handleColumnCheckMessage(std::shared_ptr<Message> _msg, P2PNetworkInterface *sender) {
-    auto data = *static_cast<MessageOf<int>*>(_msg.get())->getData();
-    int col = data;
+// Port of one of our interfaces
+uint8_t SudokuCode::portOf(P2PNetworkInterface *interface) {
+    for (int dir = 0; dir < SLattice::Direction::MAX_NB_NEIGHBORS; ++dir) {
+        if (module->getInterface(static_cast<SLattice::Direction>(dir)) == interface) {
+            return dir;
+        }
+    }
+    return SC_NO_PORT;
+}
 
-    bool isValid = true;
-    for (auto block : allBlocks) {
-        if (block->position[1] == col && hasConflict()) {
-            isValid = false;
-            break;
+// Core direction of the neighbor behind a port, from the grid positions
+uint8_t SudokuCode::dirOfPort(uint8_t port) {
+    auto neighbor = neighborAt(port);
+    if (!neighbor) return SC_NO_DIR;
+    int16_t nx = module->position[0], ny = module->position[1];
+    for (uint8_t dir = 0; dir < SC_NB_DIRS; ++dir) {
+        int16_t cx = nx, cy = ny;
+        sc_step(dir, &cx, &cy);
+        if (cx == neighbor->position[0] && cy == neighbor->position[1]) {
+            return dir;
         }
     }
+    return SC_NO_DIR;
+}
 
-    auto responseMsg = new MessageOf<bool>(COL_CHECK_MSG_ID, isValid);
-    sendMessage("ColumnCheckResponse", responseMsg, sender, 100, 200);
+// Port leading to the next cell in a core direction, SC_NO_PORT if none
+uint8_t SudokuCode::portTowards(uint8_t dir) {
+    for (int port = 0; port < SLattice::Direction::MAX_NB_NEIGHBORS; ++port) {
+        if (dirOfPort(port) == dir) {
+            return port;
+        }
+    }
+    return SC_NO_PORT;
 }
 
-// Handle box check message
-void SudokuCode::handleBoxCheckMessage(std::shared_ptr<Message> _msg, P2PNetworkInterface *sender) {
-    auto data = *static_cast<MessageOf<int>*>(_msg.get())->getData();
-    int box = data;
-
-    bool isValid = true;
-    int startX = (box / 3) * 3;
-    int startY = (box % 3) * 3;
-    for (auto block : allBlocks) {
-        if ((block->position[0] / 3 == startX / 3) && (block->position[1] / 3 == startY / 3) && hasConflict()) {
-            isValid = false;
+// Send one core message, under the message ID of the check it belongs to
+void SudokuCode::sendCore(uint8_t port, const void *msg, uint8_t size) {
+    SudokuPacket packet = {};
+    packet.size = size;
+    memcpy(packet.bytes, msg, size);
+
+    uint8_t checkType = packet.bytes[0];
+    if (checkType == SC_ACK_MSG) {
+        checkType = static_cast<const SC_AckMessage*>(msg)->processResponseType;
+    } else if (checkType == SC_CANCEL_MSG) {
+        checkType = static_cast<const SC_CancelMessage*>(msg)->processType;
+    }
+    int msgId = (checkType == SC_VERTICAL_MSG) ? ROW_CHECK_MSG_ID
+              : (checkType == SC_HORIZONTAL_MSG) ? COL_CHECK_MSG_ID : BOX_CHECK_MSG_ID;
+    auto interface = module->getInterface(static_cast<SLattice::Direction>(port));
+    if (SudokuTrace::enabled()) {
+        auto neighbor = neighborAt(port);
+        SudokuTrace::record(getScheduler()->now(), getId(), neighbor ? neighbor->blockId : 0, TRACE_SEND,
+                            port, msgId, packet.bytes, packet.size);
+    }
+    sendMessage("CoreMessage", new MessageOf<SudokuPacket>(msgId, packet), interface, 100, 200);
+}
+
+void SudokuCode::sendAck(uint8_t port, uint8_t processType, uint8_t isSuccess, uint8_t value, uint8_t seq,
+                         int16_t ox, int16_t oy) {
+    SC_AckMessage msg = {SC_ACK_MSG, processType, isSuccess, value, seq, ox, oy};
+    sendCore(port, &msg, sizeof(msg));
+}
+
+// Relay a check for its initiator; nullptr when the table is full, and the check must be failed:
+// it cannot be followed to the end, and failing never accepts a conflicting value
+SC_Relay *SudokuCode::openRelay(uint8_t type, uint8_t seq, int16_t ox, int16_t oy, uint8_t upPort,
+                                uint8_t children, uint8_t value) {
+    SC_Relay *relay = sc_relay_slot(relays, type, ox, oy);
+    if (relay) {
+        sc_relay_open(relay, type, seq, ox, oy, upPort, children, value);
+    }
+    return relay;
+}
+
+// Tell every port in `ports` to drop the given check
+void SudokuCode::sendCancels(uint8_t processType, uint8_t seq, int16_t ox, int16_t oy, uint8_t ports) {
+    SC_CancelMessage msg = {SC_CANCEL_MSG, processType, seq, ox, oy};
+    for (int port = 0; port < SLattice::Direction::MAX_NB_NEIGHBORS; ++port) {
+        if ((ports & SC_PORT_BIT(port)) && neighborAt(port)) {
+            sendCore(port, &msg, sizeof(msg));
+        }
+    }
+}
+
+// Start one stage of the distributed validation. A row shares position[0] and is walked
+// along y (VERTICAL_MSG), a column along x (HORIZONTAL_MSG), the box with the core's comb.
+void SudokuCode::startCheck(uint8_t type, uint8_t value) {
+    uint8_t previousType = check.type;
+    uint8_t previousSeq = check.seq;
+    int16_t x = localX(module), y = localY(module);
+    sendCancels(previousType, previousSeq, x, y, sc_check_begin(&check, type, value));
+
+    uint8_t dirs;
+    if (type == SC_VERTICAL_MSG) {
+        dirs = SC_PORT_BIT(SC_DIR_YPLUS) | SC_PORT_BIT(SC_DIR_YMINUS);
+    } else if (type == SC_HORIZONTAL_MSG) {
+        dirs = SC_PORT_BIT(SC_DIR_XPLUS) | SC_PORT_BIT(SC_DIR_XMINUS);
+    } else {
+        dirs = sc_dial_children(x, y, y, SC_NO_DIR, puzzle()->boxSize, puzzle()->boxSize);
+    }
+    for (uint8_t dir = 0; dir < SC_NB_DIRS; ++dir) {
+        uint8_t port = (dirs & SC_PORT_BIT(dir)) ? portTowards(dir) : SC_NO_PORT;
+        if (port == SC_NO_PORT) continue;
+        sc_check_expect(&check, port);
+        if (type == SC_DIAL_MSG) {
+            SC_DialCheckMessage msg = {SC_DIAL_MSG, 1, value, check.seq, x, y};
+            sendCore(port, &msg, sizeof(msg));
+        } else {
+            SC_ChainCheckMessage msg = {type, value, check.seq, x, y};
+            sendCore(port, &msg, sizeof(msg));
+        }
+    }
+    if (sc_check_started(&check) == SC_ACCEPTED) {
+        finishCheck(true); // Alone in that row, column or box
+    }
+}
+
+// Run the next stage, or conclude the validation
+void SudokuCode::finishCheck(bool accepted) {
+    if (!accepted) {
+        highlightConflicts(module);  // Highlight all conflicting blocks
+        scheduleOn(module, VALIDATED_ID, getScheduler()->now() + 1); // After the conflict colors
+        return;
+    }
+    uint8_t next = sc_next_stage(check.type);
+    if (next && valueOf(module) > 0) {
+        startCheck(next, valueOf(module));
+        return;
+    }
+    SudokuVisuals::setColor(module, BLACK); // If the value is valid, set color to black
+    if (puzzle()->strategy == STRATEGY_MIN_CONFLICTS && puzzle()->solving) {
+        // The search is running: only our value becomes fixed, the other blocks keep theirs
+        tentative = false;
+        announceValue();
+        refreshConflict();
+        SudokuLoad::validationFinished(getId(), getScheduler()->now());
+        return;
+    }
+    // Trigger automatic derivations, or start the min-conflicts search. The validation ends
+    // with VALIDATED_ID, once the colors they set on other blocks are in
+    deriveValues();
+}
+
+// Decode and run a core message
+void SudokuCode::processCorePacket(std::shared_ptr<Message> _msg, P2PNetworkInterface *sender) {
+    const SudokuPacket &packet = *static_cast<MessageOf<SudokuPacket>*>(_msg.get())->getData();
+    uint8_t senderPort = portOf(sender);
+    if (SudokuTrace::enabled()) {
+        auto peer = (senderPort != SC_NO_PORT) ? neighborAt(senderPort) : nullptr;
+        SudokuTrace::record(getScheduler()->now(), getId(), peer ? peer->blockId : 0, TRACE_RECEIVE,
+                            senderPort, _msg->type, packet.bytes, packet.size);
+    }
+    if (packet.size == 0 || packet.size != sc_message_size(packet.bytes[0]) || senderPort == SC_NO_PORT) {
+        return;
+    }
+    switch (packet.bytes[0]) {
+        case SC_VERTICAL_MSG:
+        case SC_HORIZONTAL_MSG:
+            processChainCheck(reinterpret_cast<const SC_ChainCheckMessage*>(packet.bytes), senderPort);
+            break;
+        case SC_DIAL_MSG:
+            processDialCheck(reinterpret_cast<const SC_DialCheckMessage*>(packet.bytes), senderPort);
+            break;
+        case SC_ACK_MSG:
+            processAck(reinterpret_cast<const SC_AckMessage*>(packet.bytes), senderPort);
             break;
+        case SC_CANCEL_MSG:
+            processCancel(reinterpret_cast<const SC_CancelMessage*>(packet.bytes), senderPort);
+            break;
+        default:
+            break;
+    }
+}
+
+// Check a row or column cell, then pass the check on straight ahead
+void SudokuCode::processChainCheck(const SC_ChainCheckMessage *msg, uint8_t senderPort) {
+    if (valueOf(module) == msg->color) {
+        sendAck(senderPort, msg->type, 0, msg->color, msg->seq, msg->ox, msg->oy); // Conflict found here
+        return;
+    }
+    uint8_t nextPort = portTowards(sc_opposite_dir(dirOfPort(senderPort)));
+    if (nextPort == SC_NO_PORT) {
+        sendAck(senderPort, msg->type, 1, msg->color, msg->seq, msg->ox, msg->oy); // End of the line
+        return;
+    }
+    if (!openRelay(msg->type, msg->seq, msg->ox, msg->oy, senderPort, SC_PORT_BIT(nextPort), msg->color)) {
+        sendAck(senderPort, msg->type, 0, msg->color, msg->seq, msg->ox, msg->oy);
+        return;
+    }
+    sendCore(nextPort, msg, sizeof(*msg));
+}
+
+// Check a box cell outside the initiator's row and column, then follow the comb
+void SudokuCode::processDialCheck(const SC_DialCheckMessage *msg, uint8_t senderPort) {
+    int16_t x = localX(module), y = localY(module);
+    if (sc_dial_must_check(x, y, msg->ox, msg->oy) && valueOf(module) == msg->color) {
+        sendAck(senderPort, SC_DIAL_MSG, 0, msg->color, msg->seq, msg->ox, msg->oy);
+        return;
+    }
+
+    uint8_t dirs = sc_dial_children(x, y, msg->oy, dirOfPort(senderPort), puzzle()->boxSize, puzzle()->boxSize);
+    uint8_t children = 0;
+    for (uint8_t dir = 0; dir < SC_NB_DIRS; ++dir) {
+        uint8_t port = (dirs & SC_PORT_BIT(dir)) ? portTowards(dir) : SC_NO_PORT;
+        if (port != SC_NO_PORT) {
+            children |= SC_PORT_BIT(port);
+        }
+    }
+    if (children == 0) {
+        sendAck(senderPort, SC_DIAL_MSG, 1, msg->color, msg->seq, msg->ox, msg->oy); // Last cell of its branch
+        return;
+    }
+    if (!openRelay(SC_DIAL_MSG, msg->seq, msg->ox, msg->oy, senderPort, children, msg->color)) {
+        sendAck(senderPort, SC_DIAL_MSG, 0, msg->color, msg->seq, msg->ox, msg->oy);
+        return;
+    }
+    SC_DialCheckMessage forward = *msg;
+    forward.count++;
+    for (int port = 0; port < SLattice::Direction::MAX_NB_NEIGHBORS; ++port) {
+        if (children & SC_PORT_BIT(port)) {
+            sendCore(port, &forward, sizeof(forward));
         }
     }
+}
 
-    auto responseMsg = new MessageOf<bool>(BOX_CHECK_MSG_ID, isValid);
-    sendMessage("BoxCheckResponse", responseMsg, sender, 100, 200);
+// Answer to our own check or to one we relay; the first failure cancels the other branches
+void SudokuCode::processAck(const SC_AckMessage *msg, uint8_t senderPort) {
+    uint8_t type = msg->processResponseType;
+    if (type < SC_HORIZONTAL_MSG || type > SC_DIAL_MSG) return;
+
+    uint8_t cancelPorts;
+    if (msg->ox == localX(module) && msg->oy == localY(module)) {
+        uint8_t result = sc_check_answer(&check, type, msg->seq, senderPort, msg->isSuccess, &cancelPorts);
+        sendCancels(type, msg->seq, msg->ox, msg->oy, cancelPorts);
+        if (result == SC_ACCEPTED || result == SC_REJECTED) {
+            finishCheck(result == SC_ACCEPTED);
+        }
+        return;
+    }
+
+    SC_Relay *relay = sc_relay_find(relays, type, msg->ox, msg->oy);
+    uint8_t result = sc_relay_answer(relay, msg->seq, senderPort, msg->isSuccess, &cancelPorts);
+    sendCancels(type, msg->seq, msg->ox, msg->oy, cancelPorts);
+    if (result == SC_ACCEPTED || result == SC_REJECTED) {
+        sendAck(relay->upPort, type, msg->isSuccess, msg->color, msg->seq, msg->ox, msg->oy);
+    }
 }
 
-// Handle solution found message
-void SudokuCode::handleSolutionFoundMessage(std::shared_ptr<Message> _msg, P2PNetworkInterface *sender) {
-    // Handle solution found message
-}
\ No newline at end of file
+void SudokuCode::processCancel(const SC_CancelMessage *msg, uint8_t senderPort) {
+    if (msg->processType < SC_HORIZONTAL_MSG || msg->processType > SC_DIAL_MSG) return;
+
+    uint8_t cancelPorts;
+    if (sc_relay_cancel(sc_relay_find(relays, msg->processType, msg->ox, msg->oy), msg->seq, senderPort,
+                        &cancelPorts)) {
+        sendCancels(msg->processType, msg->seq, msg->ox, msg->oy, cancelPorts);
+    }
+}
@@ -7,6 +7,14 @@
 #include <vector>
 #include <set>
 #include <unordered_map>
+#include <climits>
+#include <random>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include "sudokuCore.h" // Protocol core shared with the Blinky Block firmware (Core/ on the include path)
+#include "sudokuProfile.hpp"
+#include "sudokuGridState.hpp"
 
 using namespace SmartBlocks;
 
@@ -14,16 +22,134 @@ static const int ROW_CHECK_MSG_ID = 1001;
 static const int COL_CHECK_MSG_ID = 1002;
 static const int BOX_CHECK_MSG_ID = 1003;
 static const int SOLUTION_FOUND_MSG_ID = 1004;
+static const int SOLVER_VALUE_MSG_ID = 1005;
+static const int SOLVER_TICK_ID = 1; // Interruption mode of the min-conflicts steps
+static const int LOAD_TICK_ID = 2; // Interruption mode of the load generator (sudokuLoad.hpp)
+static const int SOLVER_START_ID = 3; // Interruption modes running the solver on each block of a puzzle
+static const int SOLVER_STOP_ID = 4;
+static const int DERIVE_ID = 5; // Naked-singles pass, once the blocks have dropped their tentative values
+static const int MARK_CONFLICT_ID = 6; // The block shows itself in conflict (red)
+static const int MARK_SOLVED_ID = 7; // The block shows the puzzle solved (green)
+static const int VALIDATED_ID = 8; // The colors set by a validation are in: its latency ends
+static const int LOAD_KEY_ID = 256; // Plus the key: synthetic key event delivered to its block
+static const int DERIVED_VALUE_ID = 512; // Plus the value: naked single derived for the block
+
+static const uint8_t SUDOKU_BOX_SIZE = 3; // Default box size: 3x3 cells on a 9x9 grid, `boxSize` attribute otherwise
+
+// Min-conflicts settings
+static const Time SOLVER_STEP_PERIOD = 2000; // us between two steps of a conflicting block (plus jitter)
+static const int SOLVER_TABU_TENURE = 4; // Steps during which a value left by a block is not taken back
+static const double SOLVER_NOISE = 0.05; // Probability of a random move instead of the best one
+
+enum SudokuStrategy {
+    STRATEGY_NAKED_SINGLES, // deriveValues fills the cells with a single candidate
+    STRATEGY_MIN_CONFLICTS // Empty cells hold tentative values repaired by distributed local search
+};
+
+// One independent grid of the world, with its own state and indexes. Blocks join the puzzle
+// named by their `puzzle` attribute in config.xml, or else the one of their connected component.
+// Membership (blocks, origin, box size, grid) is set once, by the first startup, under
+// SudokuCode::membershipLock, and never changes after the puzzle is published to its blocks:
+// handlers read it without locks. The values and counters are safe to use from concurrent handlers.
+struct SudokuPuzzle {
+    int id;
+    std::vector<SmartBlocksBlock*> blocks; // Blocks of this puzzle
+    std::unique_ptr<SudokuGridState> grid; // Values of the cells, sharded per box
+    int originX = INT_MAX, originY = INT_MAX; // Lowest position of the grid, its cell (0, 0)
+    int boxSize = SUDOKU_BOX_SIZE; // The grid is boxSize^2 cells wide, values are 1..boxSize^2
+    std::atomic<SudokuStrategy> strategy{STRATEGY_NAKED_SINGLES};
+    std::atomic<int> conflictingBlocks{0}; // Min-conflicts: blocks that see a conflict, 0 once converged
+    std::atomic<uint64_t> solverMoves{0}; // Values placed since solverStart: moves, or naked-single derivations
+    std::atomic<Time> solverStart{0};
+    std::atomic<bool> solving{false}; // Min-conflicts is running
+    std::atomic<bool> timing{false}; // A run of either strategy is timed until finalizeGrid sees it solved
+};
+
+// A tentative or fixed value announced to the peers of a cell, relayed along its row
+// and column (straight lines) and through its box (comb)
+struct SolverUpdate {
+    int16_t x, y;      // Local cell of the announcing block
+    int16_t oy;        // Row of the announcing block, for the box comb
+    uint16_t version;  // Newer announcements of the same cell win
+    uint8_t value;
+    uint8_t spread;    // VERTICAL_MSG (row), HORIZONTAL_MSG (column) or DIAL_MSG (box)
+};
+
+// One core message, as carried by the ROW/COL/BOX_CHECK messages
+struct SudokuPacket {
+    uint8_t size;
+    uint8_t bytes[sizeof(SC_AckMessage)]; // Largest check message
+};
 
 class SudokuCode : public SmartBlocksBlockCode {
 private:
     SmartBlocksBlock *module = nullptr; // Pointer to the current block
     bool isLeader = false; // Flag to indicate if the block is a leader
+    std::atomic<SudokuPuzzle*> currentPuzzle{nullptr}; // Puzzle of this block, stored once it is complete
+    int configPuzzleId = -1; // `puzzle` attribute from the configuration, -1 if none
+    int initialValue = 0; // Value from the configuration, stored in the puzzle at startup
+    int configBoxSize = 0; // `boxSize` attribute, 0 if none
+    int configStrategy = -1; // `solver` attribute ("minconflicts" or "singles"), -1 if none
+    bool tentative = false; // Min-conflicts: the value is the solver's, not a given or validated one
+    bool ticking = false; // A min-conflicts step is scheduled
+    bool inConflict = false; // Counted in the conflictingBlocks of the puzzle
+    uint16_t valueVersion = 0;
+    uint32_t solverStep = 0;
+    std::unordered_map<int, std::pair<uint16_t, int>> peerValues; // Local cell -> {version, value} heard from peers
+    std::vector<std::pair<int, uint32_t>> tabu; // {value, step until which it is forbidden}
+    std::mt19937 rng;
+    SC_Check check = {}; // Check initiated by this block
+    SC_Relay relays[SC_NB_RELAYS] = {}; // Checks relayed for other blocks, keyed by type and initiator
+#ifdef SUDOKU_PROFILE
+    SudokuProfile profile; // Handler timings of this block, shown in onInterfaceDraw
+#endif
     bool hasConflict(); // Check if the current block has any conflicts
     std::vector<int> findCandidates(SmartBlocksBlock* block); // Find candidate values for a given block
     void highlightConflicts(SmartBlocksBlock* block); // Highlight conflicts for a given block
     void deriveValues(); // Derive values for blocks with only one possible candidate
+    void applyDerivedValue(int value); // Take a value derived for this block by a peer's deriveValues
     std::vector<SmartBlocksBlock*> getNeighbors(SmartBlocksBlock* block); // Get the neighboring blocks of a given block
+    void joinPuzzle(); // Find the puzzle of this block, partitioning the world on the first call
+    static SudokuCode *codeOf(SmartBlocksBlock *block); // SudokuCode running on a block
+    static void buildPuzzles(const std::vector<SmartBlocksBlock*> &blocks); // New puzzles for these blocks
+    SudokuPuzzle *puzzle() const { return currentPuzzle.load(std::memory_order_acquire); }
+    SudokuGridState *grid() const { return puzzle()->grid.get(); }
+    int valueOf(SmartBlocksBlock *block) const { return grid()->value(localX(block), localY(block)); }
+    void publishValue(SmartBlocksBlock *block, int value) { grid()->publish(localX(block), localY(block), value); }
+    void scheduleOn(SmartBlocksBlock *block, int mode, Time when); // Run onInterruptionEvent on a block
+    int16_t localX(SmartBlocksBlock *block) const { return block->position[0] - puzzle()->originX; }
+    int16_t localY(SmartBlocksBlock *block) const { return block->position[1] - puzzle()->originY; }
+    int nbValues() const { return puzzle()->boxSize * puzzle()->boxSize; }
+    bool blockHasConflict(SmartBlocksBlock *block); // Any peer of the block holds the same value
+
+    // Min-conflicts strategy (sudokuSolver.cpp)
+    void startSolver(); // Announce our value, drawing a tentative one if empty
+    void stopSolver(); // Drop the tentative value when the puzzle goes back to naked singles
+    void announceValue(); // Send our value to every peer
+    void sendSolverUpdate(SolverUpdate update, uint8_t dirs); // Forward an announcement in core directions
+    void handleSolverValueMessage(std::shared_ptr<Message> _msg, P2PNetworkInterface *sender);
+    int countConflicts(int value); // Peers known to hold `value`
+    void refreshConflict(); // Update inConflict, the display and the puzzle progress
+    void scheduleSolverStep();
+    void solverMove(); // One randomized min-conflicts step with tabu memory
+    void scheduleLoadTick(); // Wake up for the next synthetic key event
+
+    // Adapter between the core and the simulator: ports are SLattice directions
+    SmartBlocksBlock* neighborAt(uint8_t port); // Block connected on a port, nullptr if none
+    uint8_t portOf(P2PNetworkInterface *interface); // Port of one of our interfaces
+    uint8_t portTowards(uint8_t dir); // Port leading to the next cell in a core direction, SC_NO_PORT if none
+    uint8_t dirOfPort(uint8_t port); // Core direction of the neighbor behind a port
+    void sendCore(uint8_t port, const void *msg, uint8_t size); // Send one core message
+    void sendAck(uint8_t port, uint8_t processType, uint8_t isSuccess, uint8_t value, uint8_t seq, int16_t ox, int16_t oy);
+    void sendCancels(uint8_t processType, uint8_t seq, int16_t ox, int16_t oy, uint8_t ports);
+    SC_Relay *openRelay(uint8_t type, uint8_t seq, int16_t ox, int16_t oy, uint8_t upPort, uint8_t children, uint8_t value);
+    void startCheck(uint8_t type, uint8_t value); // Start one stage of the distributed validation
+    void finishCheck(bool accepted); // Run the next stage, or conclude the validation
+    void processCorePacket(std::shared_ptr<Message> _msg, P2PNetworkInterface *sender); // Decode and run a core message
+    void processChainCheck(const SC_ChainCheckMessage *msg, uint8_t senderPort);
+    void processDialCheck(const SC_DialCheckMessage *msg, uint8_t senderPort);
+    void processAck(const SC_AckMessage *msg, uint8_t senderPort);
+    void processCancel(const SC_CancelMessage *msg, uint8_t senderPort);
 
     void handleRowCheckMessage(std::shared_ptr<Message> _msg, P2PNetworkInterface *sender);
     void handleColumnCheckMessage(std::shared_ptr<Message> _msg, P2PNetworkInterface *sender);
@@ -34,8 +160,9 @@ public:
     SudokuCode(SmartBlocksBlock *host); // Constructor
     ~SudokuCode() {}; // Destructor
 
-    static std::vector<SmartBlocksBlock*> allBlocks; // List of all blocks
-    static std::unordered_map<int, int> blockValues; // Map of block IDs to their values
+    static std::unordered_map<int, SudokuPuzzle> puzzles; // Puzzles of the world, by ID
+    static int nextComponentId; // IDs of the puzzles found by connected component, below -1
+    static std::mutex membershipLock; // Guards `puzzles`, `nextComponentId` and puzzle membership
 
     void startup() override; // Startup function called when the block is initialized
     void updateValue(char input); // Update the value of the current block based on user input
@@ -46,6 +173,7 @@ public:
     void onBlockSelected() override; // Handle block selection
     void onUserKeyPressed(unsigned char c, int x, int y) override; // Handle user key presses
     std::string onInterfaceDraw() override; // Draw the interface for the Sudoku module
+    void onInterruptionEvent(std::shared_ptr<Event> event) override; // Min-conflicts steps and load generator
 
     void applyDerivations(); // Apply derivations to the Sudoku grid
 
@@ -0,0 +1,117 @@
+/**
+ * @file sudokuGridState.hpp
+ * Cell values of one puzzle, sharded per grid region (box). Each region owns its cells and a
+ * version counter, on cache lines of its own, so blocks of different regions publish without
+ * sharing memory. Reads of peer values are lock-free atomic loads; a value change is published
+ * by one release store, after which the region's version is bumped.
+ * The layout (extent and box size) of a grid never changes: SudokuCode builds it once, for
+ * every block of the puzzle, before any of them starts.
+ **/
+
+#ifndef SudokuGridState_H_
+#define SudokuGridState_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+class SudokuGridState {
+public:
+    // A grid of at least width x height cells, in whole boxes of boxSize x boxSize
+    SudokuGridState(int boxSize, int width, int height)
+        : box(boxSize), regionsX((width + boxSize - 1) / boxSize), regionsY((height + boxSize - 1) / boxSize),
+          linesPerRegion((boxSize * boxSize + CELLS_PER_LINE - 1) / CELLS_PER_LINE),
+          versions(new Version[regionsX * regionsY]), lines(new Line[regionsX * regionsY * linesPerRegion]) {
+        for (int l = 0; l < regionsX * regionsY * linesPerRegion; ++l) {
+            for (int c = 0; c < CELLS_PER_LINE; ++c) {
+                lines[l].cells[c].store(0, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    int boxSize() const { return box; }
+    int width() const { return regionsX * box; }
+    int height() const { return regionsY * box; }
+    bool contains(int x, int y) const { return x >= 0 && y >= 0 && x < width() && y < height(); }
+    int regionOf(int x, int y) const { return (y / box) * regionsX + x / box; }
+
+    // Value of a cell, 0 if empty or outside the grid; lock-free
+    int value(int x, int y) const {
+        return contains(x, y) ? cell(x, y).load(std::memory_order_acquire) : 0;
+    }
+
+    // Publish a cell's new value to every reader, then bump its region's version
+    void publish(int x, int y, int value) {
+        if (!contains(x, y)) return;
+        cell(x, y).store(value, std::memory_order_release);
+        versions[regionOf(x, y)].count.fetch_add(1, std::memory_order_release);
+    }
+
+    // Number of values published in a region so far
+    uint64_t regionVersion(int region) const {
+        return versions[region].count.load(std::memory_order_acquire);
+    }
+
+    // A peer of (x, y) (same row, column or box) holds `value`
+    bool peerHolds(int x, int y, int value) const {
+        if (value == 0) return false;
+        for (int i = 0; i < width(); ++i) {
+            if (i != x && value == this->value(i, y)) return true;
+        }
+        for (int j = 0; j < height(); ++j) {
+            if (j != y && value == this->value(x, j)) return true;
+        }
+        int bx = x - x % box, by = y - y % box;
+        for (int j = by; j < by + box; ++j) {
+            for (int i = bx; i < bx + box; ++i) {
+                if (i != x && j != y && value == this->value(i, j)) return true;
+            }
+        }
+        return false;
+    }
+
+    // Mark taken[v] for every value v held by a peer of (x, y), v < taken.size()
+    void markTaken(int x, int y, std::vector<bool> &taken) const {
+        auto mark = [&taken](int v) {
+            if (v > 0 && v < (int)taken.size()) taken[v] = true;
+        };
+        for (int i = 0; i < width(); ++i) {
+            if (i != x) mark(value(i, y));
+        }
+        for (int j = 0; j < height(); ++j) {
+            if (j != y) mark(value(x, j));
+        }
+        int bx = x - x % box, by = y - y % box;
+        for (int j = by; j < by + box; ++j) {
+            for (int i = bx; i < bx + box; ++i) {
+                if (i != x && j != y) mark(value(i, j));
+            }
+        }
+    }
+
+private:
+    static const int CELLS_PER_LINE = 16;
+
+    struct alignas(64) Version {
+        std::atomic<uint64_t> count{0};
+    };
+
+    struct alignas(64) Line {
+        std::atomic<int> cells[CELLS_PER_LINE];
+    };
+
+    // A region's box x box cells are row-major in its own run of lines
+    std::atomic<int> &cell(int x, int y) const {
+        int index = (y % box) * box + x % box;
+        return lines[regionOf(x, y) * linesPerRegion + index / CELLS_PER_LINE].cells[index % CELLS_PER_LINE];
+    }
+
+    int box;
+    int regionsX, regionsY;
+    int linesPerRegion;
+    std::unique_ptr<Version[]> versions;
+    std::unique_ptr<Line[]> lines;
+};
+
+#endif /* SudokuGridState_H_ */
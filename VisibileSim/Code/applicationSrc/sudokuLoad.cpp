@@ -0,0 +1,140 @@
+#include "sudokuLoad.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+
+SudokuLoad::SudokuLoad() {
+    const char *replayPath = std::getenv("SUDOKU_LOAD_REPLAY");
+    const char *rateText = std::getenv("SUDOKU_LOAD_RATE");
+    if (replayPath && *replayPath) {
+        replay = std::fopen(replayPath, "r");
+        if (!replay) {
+            std::cerr << "SUDOKU_LOAD_REPLAY: cannot open " << replayPath << "\n";
+            return;
+        }
+        replaying = true;
+    } else if (rateText && std::atof(rateText) > 0) {
+        rate = std::atof(rateText);
+        const char *events = std::getenv("SUDOKU_LOAD_EVENTS");
+        remaining = events ? std::atol(events) : 1000;
+        const char *keyText = std::getenv("SUDOKU_LOAD_KEYS");
+        if (keyText && *keyText) keys = keyText;
+        const char *seed = std::getenv("SUDOKU_LOAD_SEED");
+        rng.seed(seed ? std::atoi(seed) : 1);
+    } else {
+        return;
+    }
+    const char *logPath = std::getenv("SUDOKU_LOAD_LOG");
+    if (logPath && *logPath) {
+        log = std::fopen(logPath, "w");
+    }
+    active = true;
+}
+
+SudokuLoad::~SudokuLoad() {
+    if (replay) std::fclose(replay);
+    if (log) std::fclose(log);
+}
+
+SudokuLoad &SudokuLoad::instance() {
+    static SudokuLoad load;
+    return load;
+}
+
+bool SudokuLoad::addBlock(int blockId, SmartBlocksBlockCode *code) {
+    SudokuLoad &load = instance();
+    if (!load.active) return false;
+    std::lock_guard<std::mutex> guard(load.lock);
+    load.blockIds.push_back(blockId);
+    load.codes[blockId] = code;
+    if (load.driverClaimed) return false;
+    load.driverClaimed = true;
+    return true;
+}
+
+bool SudokuLoad::prepareNext() {
+    if (replaying) {
+        long long time;
+        int blockId;
+        char key;
+        if (std::fscanf(replay, "%lld %d %c", &time, &blockId, &key) != 3) {
+            return false;
+        }
+        next = {(Time)std::max(time, (long long)lastTime), blockId, key};
+        return true;
+    }
+    if (remaining <= 0 || blockIds.empty()) return false;
+    remaining--;
+    // Poisson arrivals at `rate` events per simulated second
+    Time gap = (Time)(std::exponential_distribution<double>(rate)(rng) * 1e6);
+    next.time = lastTime + std::max<Time>(gap, 1);
+    next.blockId = blockIds[rng() % blockIds.size()];
+    next.key = keys[rng() % keys.size()];
+    return true;
+}
+
+bool SudokuLoad::nextEventTime(Time *when) {
+    SudokuLoad &load = instance();
+    if (!load.active) return false;
+    std::lock_guard<std::mutex> guard(load.lock);
+    if (!load.hasNext) {
+        load.hasNext = load.prepareNext();
+    }
+    if (load.hasNext) *when = load.next.time;
+    return load.hasNext;
+}
+
+SmartBlocksBlockCode *SudokuLoad::injectNext(Time now, char *key) {
+    SudokuLoad &load = instance();
+    std::lock_guard<std::mutex> guard(load.lock);
+    if (!load.hasNext) return nullptr;
+    load.hasNext = false;
+    load.lastTime = now;
+    auto code = load.codes.find(load.next.blockId);
+    if (code == load.codes.end()) return nullptr; // Replayed block absent from this world
+
+    load.injected++;
+    if (load.log) {
+        std::fprintf(load.log, "%llu %d %c\n", (unsigned long long)now, load.next.blockId, load.next.key);
+    }
+    *key = load.next.key;
+    return code->second;
+}
+
+void SudokuLoad::validationStarted(int blockId, Time now) {
+    SudokuLoad &load = instance();
+    if (!load.active) return;
+    std::lock_guard<std::mutex> guard(load.lock);
+    if (load.pendingValidations.count(blockId)) {
+        load.superseded++;
+    }
+    load.pendingValidations[blockId] = now;
+}
+
+void SudokuLoad::validationFinished(int blockId, Time now) {
+    SudokuLoad &load = instance();
+    if (!load.active) return;
+    std::lock_guard<std::mutex> guard(load.lock);
+    auto pending = load.pendingValidations.find(blockId);
+    if (pending == load.pendingValidations.end()) return;
+    load.latencies.push_back(now - pending->second);
+    load.pendingValidations.erase(pending);
+}
+
+std::string SudokuLoad::report() {
+    SudokuLoad &load = instance();
+    std::ostringstream out;
+    if (!load.active) return "";
+    std::lock_guard<std::mutex> guard(load.lock);
+    out << "Load: " << load.injected << " events injected, " << load.latencies.size() << " validations measured, "
+        << load.superseded << " superseded, " << load.pendingValidations.size() << " unfinished\n";
+    std::vector<Time> sorted = load.latencies;
+    std::sort(sorted.begin(), sorted.end());
+    if (!sorted.empty()) {
+        auto at = [&sorted](double q) { return sorted[std::min(sorted.size() - 1, (size_t)(q * sorted.size()))]; };
+        out << "Validation latency (us): p50 " << at(0.50) << "  p90 " << at(0.90) << "  p99 " << at(0.99)
+            << "  max " << sorted.back() << "\n";
+    }
+    return out.str();
+}
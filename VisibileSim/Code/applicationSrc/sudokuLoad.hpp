@@ -0,0 +1,83 @@
+/**
+ * @file sudokuLoad.hpp
+ * Synthetic interaction load for headless runs: key events injected onto random blocks
+ * at a configurable rate, or replayed from a file, and the end-to-end latency of every
+ * validation ('v') until its colors are decided.
+ *
+ * Environment:
+ *   SUDOKU_LOAD_RATE    random events per simulated second (enables the generator)
+ *   SUDOKU_LOAD_EVENTS  number of random events (default 1000)
+ *   SUDOKU_LOAD_KEYS    keys to draw from, repeat one to weight it (default "adv")
+ *   SUDOKU_LOAD_SEED    random seed (default 1)
+ *   SUDOKU_LOAD_REPLAY  file of "<time us> <block id> <key>" lines to replay instead
+ *   SUDOKU_LOAD_LOG     file where injected events are written in the replay format
+ * Key 's' stands for onBlockSelected. All entry points are safe to call from concurrent handlers.
+ **/
+
+#ifndef SudokuLoad_H_
+#define SudokuLoad_H_
+
+#include "robots/smartBlocks/smartBlocksBlockCode.h"
+#include <cstdio>
+#include <mutex>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace SmartBlocks;
+
+class SudokuLoad {
+public:
+    static bool enabled() { return instance().active; }
+
+    // Called by each block at startup; the first one hosts the generator's timer
+    static bool addBlock(int blockId, SmartBlocksBlockCode *code);
+
+    // Time of the next event to inject, false when the load is over
+    static bool nextEventTime(Time *when);
+
+    // Take the next event: the block code to deliver `key` to, nullptr if absent from this world
+    static SmartBlocksBlockCode *injectNext(Time now, char *key);
+
+    // Latency of a validation, from its 'v' to the event that sets its final colors
+    static void validationStarted(int blockId, Time now);
+    static void validationFinished(int blockId, Time now);
+
+    static std::string report();
+
+private:
+    struct KeyEvent {
+        Time time;
+        int blockId;
+        char key;
+    };
+
+    SudokuLoad();
+    ~SudokuLoad();
+    static SudokuLoad &instance();
+    bool prepareNext(); // Fill `next`, from the replay or at random
+
+    std::mutex lock; // Guards everything below `active`, which is set once at construction
+    bool active = false;
+    bool driverClaimed = false;
+    bool replaying = false;
+    double rate = 0; // Random events per simulated second
+    long remaining = 0;
+    std::string keys = "adv";
+    std::mt19937 rng;
+    FILE *replay = nullptr;
+    FILE *log = nullptr;
+    bool hasNext = false;
+    KeyEvent next = {};
+    Time lastTime = 0;
+
+    std::vector<int> blockIds; // In startup order, for random picks
+    std::unordered_map<int, SmartBlocksBlockCode*> codes;
+    std::unordered_map<int, Time> pendingValidations; // Block ID -> time of its 'v'
+    std::vector<Time> latencies;
+    uint64_t injected = 0;
+    uint64_t superseded = 0; // 'v' pressed again before the previous validation ended
+};
+
+#endif /* SudokuLoad_H_ */
@@ -0,0 +1,174 @@
+/**
+ * @file sudokuProfile.hpp
+ * Scoped timers and call counters for the SudokuCode handlers.
+ * Built with -DSUDOKU_PROFILE; otherwise SUDOKU_PROFILE_SCOPE expands to nothing.
+ * Times are wall-clock and inclusive: deriveValues includes its findCandidates calls.
+ **/
+
+#ifndef SudokuProfile_H_
+#define SudokuProfile_H_
+
+#ifdef SUDOKU_PROFILE
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+enum SudokuProfilePoint {
+    PROF_STARTUP,
+    PROF_HAS_CONFLICT,
+    PROF_FIND_CANDIDATES,
+    PROF_DERIVE_VALUES,
+    PROF_HIGHLIGHT_CONFLICTS,
+    PROF_ROW_CHECK,
+    PROF_COLUMN_CHECK,
+    PROF_BOX_CHECK,
+    PROF_SOLUTION_FOUND,
+    PROF_NB_POINTS
+};
+
+static const char *const SUDOKU_PROFILE_NAMES[PROF_NB_POINTS] = {
+    "startup", "hasConflict", "findCandidates", "deriveValues", "highlightConflicts",
+    "handleRowCheck", "handleColumnCheck", "handleBoxCheck", "handleSolutionFound"
+};
+
+// Log-linear histogram of durations in ns: 8 buckets per power of two (error < 7%)
+struct SudokuProfileHistogram {
+    static const int SUB_BUCKETS = 8;
+    static const int NB_BUCKETS = 62 * SUB_BUCKETS;
+
+    uint64_t count = 0;
+    uint64_t totalNs = 0;
+    uint32_t buckets[NB_BUCKETS] = {};
+
+    static int bucketOf(uint64_t ns) {
+        if (ns < SUB_BUCKETS) return (int)ns;
+        int power = 63 - __builtin_clzll(ns); // >= 3
+        return (power - 2) * SUB_BUCKETS + (int)((ns >> (power - 3)) & (SUB_BUCKETS - 1));
+    }
+
+    // Middle of a bucket
+    static uint64_t valueOf(int bucket) {
+        if (bucket < SUB_BUCKETS) return bucket;
+        int power = bucket / SUB_BUCKETS + 2;
+        uint64_t width = 1ull << (power - 3);
+        return (1ull << power) + (bucket % SUB_BUCKETS) * width + width / 2;
+    }
+
+    void add(uint64_t ns) {
+        count++;
+        totalNs += ns;
+        buckets[bucketOf(ns)]++;
+    }
+
+    void merge(const SudokuProfileHistogram &other) {
+        count += other.count;
+        totalNs += other.totalNs;
+        for (int b = 0; b < NB_BUCKETS; ++b) {
+            buckets[b] += other.buckets[b];
+        }
+    }
+
+    uint64_t percentile(double q) const {
+        uint64_t rank = (uint64_t)(q * count);
+        uint64_t seen = 0;
+        for (int b = 0; b < NB_BUCKETS; ++b) {
+            seen += buckets[b];
+            if (seen > rank) return valueOf(b);
+        }
+        return 0;
+    }
+};
+
+// Histograms are allocated on the first call timed at a point: a block only pays for the
+// handlers it runs, not 496 buckets for every point
+struct SudokuProfile {
+    std::unique_ptr<SudokuProfileHistogram> points[PROF_NB_POINTS];
+
+    void add(SudokuProfilePoint point, uint64_t ns) {
+        if (!points[point]) points[point].reset(new SudokuProfileHistogram());
+        points[point]->add(ns);
+    }
+
+    // Totals of the calling thread over all its blocks; the lock is only taken once per thread,
+    // to register them for global()
+    static SudokuProfile &ofThread() {
+        thread_local SudokuProfile *profile = nullptr;
+        if (!profile) {
+            profile = new SudokuProfile(); // Kept after the thread ends, for global()
+            std::lock_guard<std::mutex> guard(threadsLock());
+            threads().push_back(profile);
+        }
+        return *profile;
+    }
+
+    // Totals over all blocks, printed by main once the simulation has stopped
+    static SudokuProfile global() {
+        SudokuProfile total;
+        std::lock_guard<std::mutex> guard(threadsLock());
+        for (const SudokuProfile *profile : threads()) {
+            for (int p = 0; p < PROF_NB_POINTS; ++p) {
+                if (!profile->points[p]) continue;
+                if (!total.points[p]) total.points[p].reset(new SudokuProfileHistogram());
+                total.points[p]->merge(*profile->points[p]);
+            }
+        }
+        return total;
+    }
+
+    static std::mutex &threadsLock() {
+        static std::mutex lock;
+        return lock;
+    }
+
+    static std::vector<SudokuProfile*> &threads() {
+        static std::vector<SudokuProfile*> profiles;
+        return profiles;
+    }
+
+    std::string report() const {
+        std::string out;
+        char line[128];
+        for (int p = 0; p < PROF_NB_POINTS; ++p) {
+            if (!points[p]) continue;
+            const SudokuProfileHistogram &h = *points[p];
+            snprintf(line, sizeof(line), "%-20s %8llu calls  p50 %8.1f us  p99 %8.1f us\n", SUDOKU_PROFILE_NAMES[p],
+                     (unsigned long long)h.count, h.percentile(0.50) / 1000.0, h.percentile(0.99) / 1000.0);
+            out += line;
+        }
+        return out;
+    }
+};
+
+// Times the enclosing scope into the block's profile and the totals of the thread
+class SudokuProfileScope {
+public:
+    SudokuProfileScope(SudokuProfile &profile, SudokuProfilePoint point)
+        : profile(profile), point(point), start(std::chrono::steady_clock::now()) {}
+
+    ~SudokuProfileScope() {
+        uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        profile.add(point, ns);
+        SudokuProfile::ofThread().add(point, ns);
+    }
+
+private:
+    SudokuProfile &profile;
+    SudokuProfilePoint point;
+    std::chrono::steady_clock::time_point start;
+};
+
+#define SUDOKU_PROFILE_SCOPE(point) SudokuProfileScope sudokuProfileScope(profile, point)
+
+#else
+
+#define SUDOKU_PROFILE_SCOPE(point)
+
+#endif /* SUDOKU_PROFILE */
+
+#endif /* SudokuProfile_H_ */
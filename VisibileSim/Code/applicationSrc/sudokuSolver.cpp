@@ -0,0 +1,257 @@
+/**
+ * @file sudokuSolver.cpp
+ * Min-conflicts strategy of SudokuCode. Every block announces its value to its peers
+ * (row, column and box, relayed block to block); empty blocks hold a tentative value and,
+ * while a peer shares it, periodically move to the value the fewest peers hold, avoiding
+ * the values they recently left (tabu memory). The puzzle is solved when no block sees a
+ * conflict any more, which finalizeGrid confirms.
+ **/
+
+#include "sudokuCode.hpp"
+#include "sudokuTrace.hpp"
+#include "sudokuVisuals.hpp"
+#include "sudokuLoad.hpp"
+#include <algorithm>
+
+static int cellKey(int16_t x, int16_t y) {
+    return (int)(((uint32_t)(uint16_t)x << 16) | (uint16_t)y); // x may be negative: shift it unsigned
+}
+
+// Announce our value, drawing a tentative one if the block is empty
+void SudokuCode::startSolver() {
+    int value = valueOf(module);
+    if (value == 0 || tentative) {
+        tentative = true;
+        value = 1 + (int)(rng() % nbValues());
+        publishValue(module, value);
+        SudokuVisuals::setValue(module, value);
+    }
+    tabu.clear();
+    solverStep = 0;
+    announceValue();
+    refreshConflict();
+}
+
+// Drop the tentative value when the puzzle goes back to naked singles
+void SudokuCode::stopSolver() {
+    if (tentative) {
+        tentative = false;
+        publishValue(module, 0);
+        SudokuVisuals::setValue(module, 0);
+        SudokuVisuals::setColor(module, WHITE);
+    }
+    if (inConflict) {
+        puzzle()->conflictingBlocks--;
+    }
+    inConflict = false;
+    peerValues.clear();
+}
+
+// Send our value to every peer
+void SudokuCode::announceValue() {
+    int16_t x = localX(module), y = localY(module);
+    SolverUpdate update = {x, y, y, ++valueVersion, (uint8_t)valueOf(module), SC_VERTICAL_MSG};
+    sendSolverUpdate(update, SC_PORT_BIT(SC_DIR_YPLUS) | SC_PORT_BIT(SC_DIR_YMINUS));
+    update.spread = SC_HORIZONTAL_MSG;
+    sendSolverUpdate(update, SC_PORT_BIT(SC_DIR_XPLUS) | SC_PORT_BIT(SC_DIR_XMINUS));
+    update.spread = SC_DIAL_MSG;
+    sendSolverUpdate(update, sc_dial_children(x, y, y, SC_NO_DIR, puzzle()->boxSize, puzzle()->boxSize));
+}
+
+// Forward an announcement in the given core directions
+void SudokuCode::sendSolverUpdate(SolverUpdate update, uint8_t dirs) {
+    for (uint8_t dir = 0; dir < SC_NB_DIRS; ++dir) {
+        uint8_t port = (dirs & SC_PORT_BIT(dir)) ? portTowards(dir) : SC_NO_PORT;
+        if (port == SC_NO_PORT) continue;
+        if (SudokuTrace::enabled()) {
+            SudokuTrace::record(getScheduler()->now(), getId(), neighborAt(port)->blockId, TRACE_SEND, port,
+                                SOLVER_VALUE_MSG_ID, &update, sizeof(update));
+        }
+        auto interface = module->getInterface(static_cast<SLattice::Direction>(port));
+        sendMessage("SolverValue", new MessageOf<SolverUpdate>(SOLVER_VALUE_MSG_ID, update), interface, 100, 200);
+    }
+}
+
+// Record a peer's value and pass the announcement on along its row, column or box
+void SudokuCode::handleSolverValueMessage(std::shared_ptr<Message> _msg, P2PNetworkInterface *sender) {
+    SudokuVisuals::Batch batch;
+    SolverUpdate update = *static_cast<MessageOf<SolverUpdate>*>(_msg.get())->getData();
+    uint8_t senderPort = portOf(sender);
+    if (senderPort == SC_NO_PORT || !neighborAt(senderPort)) return;
+    if (SudokuTrace::enabled()) {
+        SudokuTrace::record(getScheduler()->now(), getId(), neighborAt(senderPort)->blockId, TRACE_RECEIVE,
+                            senderPort, SOLVER_VALUE_MSG_ID, &update, sizeof(update));
+    }
+
+    // Announcements may overtake each other: keep the newest one of each cell
+    auto known = peerValues.find(cellKey(update.x, update.y));
+    if (known == peerValues.end() || (int16_t)(update.version - known->second.first) > 0) {
+        peerValues[cellKey(update.x, update.y)] = std::make_pair(update.version, (int)update.value);
+    }
+
+    uint8_t fromDir = dirOfPort(senderPort);
+    if (update.spread == SC_DIAL_MSG) {
+        sendSolverUpdate(update, sc_dial_children(localX(module), localY(module), update.oy, fromDir,
+                                                  puzzle()->boxSize, puzzle()->boxSize));
+    } else if (fromDir != SC_NO_DIR) {
+        sendSolverUpdate(update, SC_PORT_BIT(sc_opposite_dir(fromDir)));
+    }
+    if (puzzle()->solving) {
+        refreshConflict();
+    }
+}
+
+// Peers known to hold `value`
+int SudokuCode::countConflicts(int value) {
+    int count = 0;
+    for (auto &peer : peerValues) {
+        if (peer.second.second == value) count++;
+    }
+    return count;
+}
+
+// Update inConflict, the display and the puzzle progress
+void SudokuCode::refreshConflict() {
+    int value = valueOf(module);
+    bool conflict = value > 0 && countConflicts(value) > 0;
+    if (tentative) {
+        SudokuVisuals::setColor(module, conflict ? ORANGE : YELLOW);
+    }
+    if (conflict != inConflict) {
+        inConflict = conflict;
+        int remaining = (puzzle()->conflictingBlocks += conflict ? 1 : -1);
+        if (!conflict && remaining == 0 && puzzle()->solving) {
+            finalizeGrid(); // No block sees a conflict: check the grid as a whole
+        }
+    }
+    if (conflict && tentative) {
+        scheduleSolverStep();
+    }
+}
+
+// Wake up for the next synthetic key event; the generator runs on the first block
+void SudokuCode::scheduleLoadTick() {
+    Time when;
+    if (SudokuLoad::nextEventTime(&when)) {
+        scheduleOn(module, LOAD_TICK_ID, std::max(when, getScheduler()->now() + 1));
+    }
+}
+
+void SudokuCode::scheduleSolverStep() {
+    if (ticking) return;
+    ticking = true;
+    Time jitter = rng() % SOLVER_STEP_PERIOD; // Peers must not all move at the same time
+    scheduleOn(module, SOLVER_TICK_ID, getScheduler()->now() + SOLVER_STEP_PERIOD + jitter);
+}
+
+// Run onInterruptionEvent on a block. A block only writes its own cell, colors and per-block
+// state; what it wants done to another block (a derived value, a conflict or solved color, a
+// solver start or stop) is an event of that block, so blocks can be processed in parallel
+void SudokuCode::scheduleOn(SmartBlocksBlock *block, int mode, Time when) {
+    getScheduler()->schedule(new InterruptionEvent(when, block, mode));
+}
+
+void SudokuCode::onInterruptionEvent(std::shared_ptr<Event> event) {
+    int mode = std::static_pointer_cast<InterruptionEvent>(event)->mode;
+    if (mode >= DERIVED_VALUE_ID) {
+        SudokuVisuals::Batch batch;
+        applyDerivedValue(mode - DERIVED_VALUE_ID);
+        return;
+    }
+    if (mode >= LOAD_KEY_ID) {
+        if (mode - LOAD_KEY_ID == 's') {
+            onBlockSelected();
+        } else {
+            onUserKeyPressed(mode - LOAD_KEY_ID, 0, 0);
+        }
+        return;
+    }
+    if (mode == LOAD_TICK_ID) {
+        char key;
+        SmartBlocksBlockCode *target = SudokuLoad::injectNext(getScheduler()->now(), &key);
+        SudokuCode *code = target ? dynamic_cast<SudokuCode*>(target) : nullptr;
+        if (code) {
+            scheduleOn(code->module, LOAD_KEY_ID + (unsigned char)key, getScheduler()->now());
+        }
+        scheduleLoadTick();
+        return;
+    }
+    if (mode == VALIDATED_ID) {
+        SudokuLoad::validationFinished(getId(), getScheduler()->now());
+        return;
+    }
+    if (mode == MARK_CONFLICT_ID || mode == MARK_SOLVED_ID) {
+        SudokuVisuals::Batch batch;
+        SudokuVisuals::setColor(module, mode == MARK_CONFLICT_ID ? RED : GREEN);
+        return;
+    }
+    if (mode == SOLVER_START_ID || mode == SOLVER_STOP_ID || mode == DERIVE_ID) {
+        SudokuVisuals::Batch batch;
+        if (mode == SOLVER_START_ID) {
+            startSolver();
+        } else if (mode == SOLVER_STOP_ID) {
+            stopSolver();
+        } else if (puzzle()->strategy == STRATEGY_NAKED_SINGLES) { // Not switched away since
+            deriveValues();
+        } else {
+            SudokuLoad::validationFinished(getId(), getScheduler()->now()); // The chain stops here
+        }
+        return;
+    }
+    if (mode != SOLVER_TICK_ID) return;
+    ticking = false;
+    if (!tentative || !puzzle()->solving) return;
+    SudokuVisuals::Batch batch;
+    solverMove();
+}
+
+// One randomized min-conflicts step with tabu memory
+void SudokuCode::solverMove() {
+    solverStep++;
+    int n = nbValues();
+    std::vector<int> counts(n + 1, 0);
+    for (auto &peer : peerValues) {
+        if (peer.second.second >= 1 && peer.second.second <= n) counts[peer.second.second]++;
+    }
+    int current = valueOf(module);
+    if (counts[current] == 0) {
+        refreshConflict();
+        return;
+    }
+    tabu.erase(std::remove_if(tabu.begin(), tabu.end(), [this](const std::pair<int, uint32_t> &t) {
+        return t.second < solverStep;
+    }), tabu.end());
+
+    int best = 0;
+    if (std::uniform_real_distribution<double>(0.0, 1.0)(rng) < SOLVER_NOISE) {
+        best = 1 + (int)(rng() % n); // Random walk, to leave local minima
+    } else {
+        int bestCount = INT_MAX, ties = 0;
+        for (int v = 1; v <= n; ++v) {
+            if (v == current) continue;
+            bool isTabu = std::any_of(tabu.begin(), tabu.end(), [v](const std::pair<int, uint32_t> &t) {
+                return t.first == v;
+            });
+            if (isTabu && counts[v] > 0) continue; // A conflict-free value is always allowed
+            if (counts[v] < bestCount) {
+                best = v;
+                bestCount = counts[v];
+                ties = 1;
+            } else if (counts[v] == bestCount && rng() % ++ties == 0) {
+                best = v; // Uniform choice among the ties
+            }
+        }
+        if (best != 0 && bestCount > counts[current]) {
+            best = 0; // Every allowed move is worse: stay
+        }
+    }
+
+    if (best != 0 && best != current) {
+        tabu.push_back(std::make_pair(current, solverStep + SOLVER_TABU_TENURE));
+        publishValue(module, best);
+        puzzle()->solverMoves++;
+        SudokuVisuals::setValue(module, best);
+        announceValue();
+    }
+    refreshConflict();
+}
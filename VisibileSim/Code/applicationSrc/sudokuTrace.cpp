@@ -0,0 +1,105 @@
+#include "sudokuTrace.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+SudokuTrace::SudokuTrace() {
+    const char *path = std::getenv("SUDOKU_TRACE");
+    if (!path || !*path) return;
+
+    file = std::fopen(path, "wb");
+    if (!file) return;
+    SudokuTraceHeader header;
+    memcpy(header.magic, SUDOKU_TRACE_MAGIC, sizeof(header.magic));
+    header.version = SUDOKU_TRACE_VERSION;
+    header.recordSize = sizeof(SudokuTraceRecord);
+    std::fwrite(&header, sizeof(header), 1, file);
+
+    ring = new SudokuTraceRecord[RING_SIZE];
+    published = new std::atomic<size_t>[RING_SIZE];
+    for (size_t i = 0; i < RING_SIZE; ++i) {
+        published[i].store(0, std::memory_order_relaxed);
+    }
+    running = true;
+    flusher = std::thread(&SudokuTrace::flusherLoop, this);
+}
+
+SudokuTrace::~SudokuTrace() {
+    shutdown();
+}
+
+SudokuTrace &SudokuTrace::instance() {
+    static SudokuTrace trace;
+    return trace;
+}
+
+// Many producers (the simulation threads) claim slots; a single consumer (the flusher)
+void SudokuTrace::record(uint64_t time, uint32_t blockId, uint32_t peerId, uint8_t event,
+                         uint8_t interface, uint16_t msgId, const void *payload, uint8_t size) {
+    SudokuTrace &trace = instance();
+    if (!trace.file) return;
+
+    size_t slot = trace.head.fetch_add(1, std::memory_order_relaxed);
+    while (slot - trace.tail.load(std::memory_order_acquire) >= RING_SIZE) {
+        std::this_thread::yield(); // Ring full: wait for the flusher rather than lose records
+    }
+    SudokuTraceRecord &r = trace.ring[slot & (RING_SIZE - 1)];
+    r.time = time;
+    r.blockId = blockId;
+    r.peerId = peerId;
+    r.msgId = msgId;
+    r.event = event;
+    r.interface = interface;
+    r.size = std::min<uint8_t>(size, SUDOKU_TRACE_PAYLOAD);
+    memcpy(r.payload, payload, r.size);
+    memset(r.payload + r.size, 0, SUDOKU_TRACE_PAYLOAD - r.size);
+    trace.published[slot & (RING_SIZE - 1)].store(slot + 1, std::memory_order_release);
+}
+
+// Write the records published so far, up to the first slot still being filled, in contiguous
+// chunks of the ring
+size_t SudokuTrace::drain() {
+    size_t first = tail.load(std::memory_order_relaxed);
+    size_t last = first;
+    while (published[last & (RING_SIZE - 1)].load(std::memory_order_acquire) == last + 1) {
+        last++;
+    }
+    size_t done = first;
+    while (done < last) {
+        size_t index = done & (RING_SIZE - 1);
+        size_t count = std::min(last - done, RING_SIZE - index);
+        std::fwrite(ring + index, sizeof(SudokuTraceRecord), count, file);
+        done += count;
+    }
+    tail.store(done, std::memory_order_release);
+    return done - first;
+}
+
+void SudokuTrace::flusherLoop() {
+    while (running.load(std::memory_order_acquire)) {
+        if (drain() == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+    }
+    drain();
+}
+
+void SudokuTrace::close() {
+    instance().shutdown();
+}
+
+void SudokuTrace::shutdown() {
+    if (!file) return;
+
+    running = false;
+    if (flusher.joinable()) {
+        flusher.join();
+    }
+    std::fclose(file);
+    file = nullptr;
+    delete[] ring;
+    ring = nullptr;
+    delete[] published;
+    published = nullptr;
+}
@@ -0,0 +1,73 @@
+/**
+ * @file sudokuTrace.hpp
+ * Binary trace of the messages sent and received by SudokuCode.
+ * Records go through a lock-free ring buffer, which any number of simulation threads may
+ * fill, and are written to disk by a background thread. Tracing is on when the SUDOKU_TRACE
+ * environment variable names the output file.
+ **/
+
+#ifndef SudokuTrace_H_
+#define SudokuTrace_H_
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+
+static const char SUDOKU_TRACE_MAGIC[4] = {'S', 'D', 'K', 'T'};
+static const uint16_t SUDOKU_TRACE_VERSION = 1;
+static const uint8_t SUDOKU_TRACE_PAYLOAD = 16;
+
+enum SudokuTraceEvent : uint8_t { TRACE_SEND = 0, TRACE_RECEIVE = 1 };
+
+// One record on disk, after the {magic, version, record size} header
+#pragma pack(push, 1)
+struct SudokuTraceRecord {
+    uint64_t time;      // Simulated time (us)
+    uint32_t blockId;
+    uint32_t peerId;    // Block on the other end of the link, 0 if unknown
+    uint16_t msgId;
+    uint8_t event;      // TRACE_SEND or TRACE_RECEIVE
+    uint8_t interface;  // SLattice direction of the link on blockId's side
+    uint8_t size;       // Payload bytes kept, at most SUDOKU_TRACE_PAYLOAD
+    uint8_t payload[SUDOKU_TRACE_PAYLOAD];
+};
+
+struct SudokuTraceHeader {
+    char magic[4];
+    uint16_t version;
+    uint16_t recordSize;
+};
+#pragma pack(pop)
+
+class SudokuTrace {
+public:
+    static bool enabled() { return instance().file != nullptr; }
+
+    // Record one message; never blocks the simulation unless the ring is full
+    static void record(uint64_t time, uint32_t blockId, uint32_t peerId, uint8_t event,
+                       uint8_t interface, uint16_t msgId, const void *payload, uint8_t size);
+
+    // Flush the ring and close the file; called once at the end of main
+    static void close();
+
+private:
+    static const size_t RING_SIZE = 1 << 16; // Records, a power of two
+
+    SudokuTrace();
+    ~SudokuTrace();
+    static SudokuTrace &instance();
+    void flusherLoop();
+    size_t drain();
+    void shutdown();
+
+    FILE *file = nullptr;
+    SudokuTraceRecord *ring = nullptr;
+    std::atomic<size_t> *published = nullptr; // Per slot: index of the record it holds, plus one
+    std::atomic<size_t> head{0}; // Next slot claimed by the simulation
+    std::atomic<size_t> tail{0}; // Next slot written to disk by the flusher
+    std::atomic<bool> running{false};
+    std::thread flusher;
+};
+
+#endif /* SudokuTrace_H_ */
@@ -0,0 +1,105 @@
+#include "sudokuVisuals.hpp"
+#include <cstring>
+
+thread_local std::unordered_map<SmartBlocksBlock*, SudokuVisuals::State> SudokuVisuals::pending;
+thread_local std::vector<SmartBlocksBlock*> SudokuVisuals::dirty;
+thread_local uint64_t SudokuVisuals::pendingWrites = 0;
+thread_local int SudokuVisuals::depth = 0;
+SudokuVisuals::Shard SudokuVisuals::shards[SudokuVisuals::NB_SHARDS];
+std::mutex SudokuVisuals::countersLock;
+std::vector<SudokuVisuals::Counters*> SudokuVisuals::allCounters;
+SudokuVisuals::Stats SudokuVisuals::interactionStart;
+
+SudokuVisuals::Counters &SudokuVisuals::counters() {
+    thread_local Counters *mine = nullptr;
+    if (!mine) {
+        mine = new Counters(); // Kept after the thread ends, its counts still belong to the totals
+        std::lock_guard<std::mutex> guard(countersLock);
+        allCounters.push_back(mine);
+    }
+    return *mine;
+}
+
+// Caller holds countersLock
+SudokuVisuals::Stats SudokuVisuals::sum() {
+    Stats stats;
+    for (const Counters *c : allCounters) {
+        stats.writes += c->writes.load(std::memory_order_relaxed);
+        stats.changes += c->changes.load(std::memory_order_relaxed);
+    }
+    return stats;
+}
+
+void SudokuVisuals::startInteraction() {
+    std::lock_guard<std::mutex> guard(countersLock);
+    interactionStart = sum();
+}
+
+SudokuVisuals::Stats SudokuVisuals::interactionStats() {
+    std::lock_guard<std::mutex> guard(countersLock);
+    Stats stats = sum();
+    stats.writes -= interactionStart.writes;
+    stats.changes -= interactionStart.changes;
+    return stats;
+}
+
+SudokuVisuals::Stats SudokuVisuals::totalStats() {
+    std::lock_guard<std::mutex> guard(countersLock);
+    return sum();
+}
+
+SudokuVisuals::State &SudokuVisuals::pendingFor(SmartBlocksBlock *block) {
+    auto it = pending.find(block);
+    if (it == pending.end()) {
+        dirty.push_back(block);
+        it = pending.emplace(block, State()).first;
+    }
+    return it->second;
+}
+
+void SudokuVisuals::wrote() {
+    pendingWrites++;
+    if (depth == 0) flush(); // Outside any batch: write through
+}
+
+void SudokuVisuals::setColor(SmartBlocksBlock *block, const Color &color) {
+    State &state = pendingFor(block);
+    state.color = color;
+    state.hasColor = true;
+    wrote();
+}
+
+void SudokuVisuals::setValue(SmartBlocksBlock *block, int value) {
+    State &state = pendingFor(block);
+    state.value = value;
+    state.hasValue = true;
+    wrote();
+}
+
+void SudokuVisuals::flush() {
+    Counters &mine = counters();
+    uint64_t changes = 0;
+    for (auto block : dirty) {
+        const State &want = pending[block];
+        Shard &shard = shards[(reinterpret_cast<uintptr_t>(block) / sizeof(void*)) % NB_SHARDS];
+        std::lock_guard<std::mutex> guard(shard.lock);
+        State &shown = shard.applied[block];
+        if (want.hasValue && (!shown.hasValue || shown.value != want.value)) {
+            block->setDisplayedValue(want.value);
+            shown.value = want.value;
+            shown.hasValue = true;
+            changes++;
+        }
+        if (want.hasColor && (!shown.hasColor || memcmp(&shown.color, &want.color, sizeof(Color)) != 0)) {
+            block->setColor(want.color);
+            shown.color = want.color;
+            shown.hasColor = true;
+            changes++;
+        }
+    }
+    mine.writes.fetch_add(pendingWrites, std::memory_order_relaxed);
+    mine.changes.fetch_add(changes, std::memory_order_relaxed);
+    pendingWrites = 0;
+    dirty.clear();
+    pending.clear();
+}
@@ -0,0 +1,90 @@
+/**
+ * @file sudokuVisuals.hpp
+ * Deferred color and value updates. Writes are recorded per block in a dirty set and
+ * applied once at the end of the event batch (startup, key press, message handler),
+ * keeping only the last write per block and skipping those that change nothing.
+ * Batches and counters are per thread. The render state they are applied to is split in
+ * shards, each under its own lock, so threads flushing different blocks rarely wait.
+ **/
+
+#ifndef SudokuVisuals_H_
+#define SudokuVisuals_H_
+
+#include "robots/smartBlocks/smartBlocksBlockCode.h"
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+using namespace SmartBlocks;
+
+class SudokuVisuals {
+public:
+    struct Stats {
+        uint64_t writes = 0;  // setColor/setValue calls
+        uint64_t changes = 0; // Render-state changes actually applied
+        uint64_t dropped() const { return writes - changes; }
+    };
+
+    static void setColor(SmartBlocksBlock *block, const Color &color);
+    static void setValue(SmartBlocksBlock *block, int value);
+
+    // Apply the pending writes; done automatically when the outermost batch ends
+    static void flush();
+
+    // Start counting a new user interaction (key press) and its message cascade
+    static void startInteraction();
+
+    static Stats interactionStats();
+    static Stats totalStats();
+
+    // Scope of one event: writes made inside are applied once when it ends
+    class Batch {
+    public:
+        Batch() { depth++; }
+        ~Batch() {
+            if (--depth == 0) flush();
+        }
+    };
+
+private:
+    struct State {
+        Color color;
+        int value = 0;
+        bool hasColor = false;
+        bool hasValue = false;
+    };
+
+    // Counters of one thread, written by it alone and summed when read
+    struct alignas(64) Counters {
+        std::atomic<uint64_t> writes{0};
+        std::atomic<uint64_t> changes{0};
+    };
+
+    // Last state sent to the renderer, for the blocks hashed to this shard
+    struct alignas(64) Shard {
+        std::mutex lock;
+        std::unordered_map<SmartBlocksBlock*, State> applied;
+    };
+
+    static const int NB_SHARDS = 64;
+
+    static State &pendingFor(SmartBlocksBlock *block);
+    static void wrote();
+    static Counters &counters(); // Of the calling thread
+    static Stats sum(); // Over every thread
+
+    // Batch of the calling thread
+    static thread_local std::unordered_map<SmartBlocksBlock*, State> pending;
+    static thread_local std::vector<SmartBlocksBlock*> dirty; // Blocks of `pending`, in first-write order
+    static thread_local uint64_t pendingWrites;
+    static thread_local int depth;
+
+    static Shard shards[NB_SHARDS];
+    static std::mutex countersLock; // Guards the list below, only taken once per thread and when reading
+    static std::vector<Counters*> allCounters;
+    static Stats interactionStart; // sum() when the interaction started, under countersLock
+};
+
+#endif /* SudokuVisuals_H_ */
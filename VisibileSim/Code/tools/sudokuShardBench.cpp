@@ -0,0 +1,253 @@
+/**
+ * @file sudokuShardBench.cpp
+ * Proxy microbenchmark of the puzzle state from 1 to N threads. It does not run SudokuCode
+ * handlers or VisibleSim events (the simulator's scheduler runs one event at a time): each
+ * thread runs hand-written imitations of the handlers' work, for the blocks of some regions
+ * (boxes): key presses (updateValue, hasConflict), validations (hasConflict, findCandidates),
+ * dropped tentative values (stopSolver) and naked-singles passes (deriveValues) over the
+ * whole puzzle. A pass sends each derived value to the thread of its block as an event
+ * (applyDerivedValue), so regions are also written across threads. The same events run on
+ * the sharded SudokuGridState and on a baseline: the per-puzzle unordered_map of values
+ * SudokuCode kept before, which was not thread-safe, here behind one lock per puzzle so that
+ * threads can share it.
+ * Build: g++ -std=c++17 -O2 -pthread -I../applicationSrc sudokuShardBench.cpp -o sudokuShardBench
+ * Usage: sudokuShardBench [maxThreads] [boxSize] [puzzles] [operations]
+ **/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "sudokuGridState.hpp"
+
+using namespace std;
+
+// The former per-puzzle map of block values, behind a lock
+class LockedState {
+public:
+    LockedState(int boxSize, int width, int height) : box(boxSize), w(width), h(height) {}
+
+    int value(int x, int y) {
+        lock_guard<mutex> guard(lock);
+        return valueLocked(x, y);
+    }
+
+    void publish(int x, int y, int value) {
+        lock_guard<mutex> guard(lock);
+        values[key(x, y)] = value;
+    }
+
+    bool peerHolds(int x, int y, int value) {
+        lock_guard<mutex> guard(lock);
+        if (value == 0) return false;
+        for (int i = 0; i < w; ++i) {
+            if (i != x && valueLocked(i, y) == value) return true;
+        }
+        for (int j = 0; j < h; ++j) {
+            if (j != y && valueLocked(x, j) == value) return true;
+        }
+        int bx = x - x % box, by = y - y % box;
+        for (int j = by; j < by + box; ++j) {
+            for (int i = bx; i < bx + box; ++i) {
+                if (i != x && j != y && valueLocked(i, j) == value) return true;
+            }
+        }
+        return false;
+    }
+
+    void markTaken(int x, int y, vector<bool> &taken) {
+        lock_guard<mutex> guard(lock);
+        auto mark = [&taken](int v) {
+            if (v > 0 && v < (int)taken.size()) taken[v] = true;
+        };
+        for (int i = 0; i < w; ++i) {
+            if (i != x) mark(valueLocked(i, y));
+        }
+        for (int j = 0; j < h; ++j) {
+            if (j != y) mark(valueLocked(x, j));
+        }
+        int bx = x - x % box, by = y - y % box;
+        for (int j = by; j < by + box; ++j) {
+            for (int i = bx; i < bx + box; ++i) {
+                if (i != x && j != y) mark(valueLocked(i, j));
+            }
+        }
+    }
+
+private:
+    static int key(int x, int y) { return (x << 16) | y; }
+
+    int valueLocked(int x, int y) {
+        auto it = values.find(key(x, y));
+        return it == values.end() ? 0 : it->second;
+    }
+
+    int box, w, h;
+    mutex lock;
+    unordered_map<int, int> values;
+};
+
+// A value derived for a block, run by the thread of that block
+struct DerivedEvent {
+    int puzzle, cell, value;
+};
+
+// Events queued for one thread, as the simulator scheduler queues them
+struct alignas(64) Inbox {
+    mutex lock;
+    vector<DerivedEvent> events;
+};
+
+template <class State>
+struct Bench {
+    vector<State*> puzzles;
+    int boxSize, size, threads;
+    vector<Inbox> inboxes;
+
+    Bench(int boxSize, int nbPuzzles, int threads)
+        : boxSize(boxSize), size(boxSize * boxSize), threads(threads), inboxes(threads) {
+        for (int p = 0; p < nbPuzzles; ++p) {
+            puzzles.push_back(new State(boxSize, size, size));
+        }
+    }
+
+    ~Bench() {
+        for (auto state : puzzles) {
+            delete state;
+        }
+    }
+
+    // Thread running the events of a cell: every region r with r % threads == thread
+    int ownerOf(int puzzle, int cell) const {
+        int region = (cell / size / boxSize) * boxSize + (cell % size) / boxSize;
+        return (int)(((long)puzzle * boxSize * boxSize + region) % threads);
+    }
+
+    vector<int> findCandidates(State *state, int x, int y, vector<bool> &taken) {
+        fill(taken.begin(), taken.end(), false);
+        state->markTaken(x, y, taken);
+        vector<int> candidates;
+        for (int v = 1; v <= size; ++v) {
+            if (!taken[v]) candidates.push_back(v);
+        }
+        return candidates;
+    }
+
+    // deriveValues: every empty cell of the puzzle with a single candidate is sent to its block
+    void deriveValues(int puzzle, vector<bool> &taken) {
+        State *state = puzzles[puzzle];
+        for (int c = 0; c < size * size; ++c) {
+            int x = c % size, y = c / size;
+            if (state->value(x, y) != 0) continue;
+            vector<int> candidates = findCandidates(state, x, y, taken);
+            if (candidates.size() == 1) {
+                Inbox &inbox = inboxes[ownerOf(puzzle, c)];
+                lock_guard<mutex> guard(inbox.lock);
+                inbox.events.push_back({puzzle, c, candidates[0]});
+            }
+        }
+    }
+
+    // applyDerivedValue of the events queued for this thread
+    void runInbox(int thread, vector<DerivedEvent> &batch) {
+        {
+            lock_guard<mutex> guard(inboxes[thread].lock);
+            batch.swap(inboxes[thread].events);
+        }
+        for (const DerivedEvent &event : batch) {
+            State *state = puzzles[event.puzzle];
+            int x = event.cell % size, y = event.cell / size;
+            if (state->value(x, y) == 0) state->publish(x, y, event.value);
+        }
+        batch.clear();
+    }
+
+    void work(int thread, long operations) {
+        vector<pair<int, int>> cells; // {puzzle, cell} of the blocks of this thread
+        for (int p = 0; p < (int)puzzles.size(); ++p) {
+            for (int c = 0; c < size * size; ++c) {
+                if (ownerOf(p, c) == thread) cells.push_back(make_pair(p, c));
+            }
+        }
+        if (cells.empty()) return;
+
+        mt19937 rng(thread + 1);
+        vector<bool> taken(size + 1);
+        vector<DerivedEvent> batch;
+        for (long op = 0; op < operations; ++op) {
+            runInbox(thread, batch);
+            const pair<int, int> &cell = cells[rng() % cells.size()];
+            State *state = puzzles[cell.first];
+            int x = cell.second % size, y = cell.second / size;
+            int action = rng() % 16;
+            if (action == 0) {
+                deriveValues(cell.first, taken);
+            } else if (action <= 2) {
+                state->publish(x, y, 0); // stopSolver drops a tentative value
+            } else if (action <= 8) {
+                int value = state->value(x, y) % size + 1; // updateValue('>')
+                state->publish(x, y, value);
+                state->peerHolds(x, y, value); // hasConflict
+            } else {
+                state->peerHolds(x, y, state->value(x, y)); // validateValue
+                findCandidates(state, x, y, taken);
+            }
+        }
+        runInbox(thread, batch);
+    }
+};
+
+// Events per second over `threads` threads, `operations` in total
+template <class State>
+static double run(int threads, int boxSize, int nbPuzzles, long operations) {
+    Bench<State> bench(boxSize, nbPuzzles, threads);
+    auto start = chrono::steady_clock::now();
+    vector<thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&bench, t, threads, operations]() { bench.work(t, operations / threads); });
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return (operations / threads) * threads / seconds;
+}
+
+int main(int argc, char **argv) {
+    int maxThreads = (argc > 1) ? atoi(argv[1]) : (int)thread::hardware_concurrency();
+    int boxSize = (argc > 2) ? atoi(argv[2]) : 3;
+    int nbPuzzles = (argc > 3) ? atoi(argv[3]) : 16;
+    long operations = (argc > 4) ? atol(argv[4]) : 1000000;
+    if (maxThreads < 1) maxThreads = 1;
+    if (boxSize < 2 || nbPuzzles < 1 || operations < 1) {
+        fprintf(stderr, "Usage: %s [maxThreads] [boxSize >= 2] [puzzles] [operations]\n", argv[0]);
+        return 1;
+    }
+
+    printf("%d puzzles of %dx%d cells, %ld events, %u cores\n", nbPuzzles, boxSize * boxSize, boxSize * boxSize,
+           operations, thread::hardware_concurrency());
+    printf("%8s %16s %8s %8s %16s %8s\n", "threads", "sharded ev/s", "speedup", "eff.", "locked ev/s", "speedup");
+    vector<int> counts; // 1, 2, 4... and maxThreads
+    for (int threads = 1; threads < maxThreads; threads *= 2) {
+        counts.push_back(threads);
+    }
+    counts.push_back(maxThreads);
+
+    double shardedBase = 0, lockedBase = 0;
+    for (int threads : counts) {
+        double sharded = run<SudokuGridState>(threads, boxSize, nbPuzzles, operations);
+        double locked = run<LockedState>(threads, boxSize, nbPuzzles, operations);
+        if (threads == 1) {
+            shardedBase = sharded;
+            lockedBase = locked;
+        }
+        printf("%8d %16.0f %7.2fx %7.0f%% %16.0f %7.2fx\n", threads, sharded, sharded / shardedBase,
+               100.0 * sharded / shardedBase / threads, locked, locked / lockedBase);
+    }
+    return 0;
+}
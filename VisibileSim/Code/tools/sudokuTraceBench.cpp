@@ -0,0 +1,56 @@
+/**
+ * @file sudokuTraceBench.cpp
+ * Cost of the SudokuCode trace hook per message, with tracing off or on. The hook is the one
+ * of sendCore and processCorePacket: a check of SudokuTrace::enabled(), then a record.
+ * Run it once without SUDOKU_TRACE and once with it naming a file to compare both.
+ * Build: g++ -std=c++17 -O2 -pthread -I../applicationSrc sudokuTraceBench.cpp ../applicationSrc/sudokuTrace.cpp -o sudokuTraceBench
+ * Usage: [SUDOKU_TRACE=<file>] sudokuTraceBench [records] [threads]
+ **/
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+#include "sudokuTrace.hpp"
+
+using namespace std;
+
+// Messages recorded by one thread, as the handlers of its blocks would
+static void work(int thread, long records) {
+    uint8_t payload[SUDOKU_TRACE_PAYLOAD] = {};
+    for (long i = 0; i < records; ++i) {
+        payload[0] = (uint8_t)i;
+        if (SudokuTrace::enabled()) {
+            SudokuTrace::record((uint64_t)i, (uint32_t)thread + 1, (uint32_t)(i & 0xFF), i & 1, (uint8_t)(i % 4),
+                                1001 + (uint16_t)(i % 3), payload, sizeof(payload));
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    long records = (argc > 1) ? atol(argv[1]) : 4000000;
+    int threads = (argc > 2) ? atoi(argv[2]) : 1;
+    if (records < 1 || threads < 1) {
+        fprintf(stderr, "Usage: [SUDOKU_TRACE=<file>] %s [records] [threads]\n", argv[0]);
+        return 1;
+    }
+
+    bool traced = SudokuTrace::enabled();
+    auto start = chrono::steady_clock::now();
+    vector<thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back(work, t, records / threads);
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    double hooks = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+    SudokuTrace::close(); // Written to disk, as at the end of a simulation
+    double total = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+
+    long done = (records / threads) * threads;
+    printf("tracing %s, %ld records, %d threads\n", traced ? "on" : "off", done, threads);
+    printf("%.1f ns per message in the handlers, %.1f ns including the final flush\n", hooks / done, total / done);
+    return 0;
+}
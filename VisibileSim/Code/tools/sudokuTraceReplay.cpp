@@ -0,0 +1,233 @@
+/**
+ * @file sudokuTraceReplay.cpp
+ * Offline analysis of a SUDOKU_TRACE file: per-block timelines, send/receive matching,
+ * message fan-out and the critical path of each validation.
+ * Build: g++ -std=c++17 -O2 -I../applicationSrc -I../../../Core sudokuTraceReplay.cpp -o sudokuTraceReplay
+ * Usage: sudokuTraceReplay <trace> [--timeline] [--paths N]
+ **/
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+#include "sudokuTrace.hpp"
+#include "sudokuCore.h"
+
+using namespace std;
+
+static const size_t NONE = (size_t)-1;
+
+// SudokuCode message IDs (sudokuCode.hpp); only the checks carry a core message
+static const uint16_t ROW_CHECK_MSG_ID = 1001;
+static const uint16_t COL_CHECK_MSG_ID = 1002;
+static const uint16_t BOX_CHECK_MSG_ID = 1003;
+static const uint16_t SOLUTION_FOUND_MSG_ID = 1004;
+static const uint16_t SOLVER_VALUE_MSG_ID = 1005;
+
+// A trace record with the links rebuilt by the analysis
+struct Event {
+    SudokuTraceRecord r;
+    size_t match = NONE; // Send <-> receive of the same message
+    size_t cause = NONE; // Receive whose handler issued this send, or the send of this receive
+    size_t root = NONE;  // First send of the causal chain
+    int depth = 0;
+};
+
+static bool carriesCore(const SudokuTraceRecord &r) {
+    return r.size > 0 && (r.msgId == ROW_CHECK_MSG_ID || r.msgId == COL_CHECK_MSG_ID || r.msgId == BOX_CHECK_MSG_ID);
+}
+
+// Core type of a check message, the SudokuCode message otherwise
+static const char *typeName(const SudokuTraceRecord &r) {
+    if (carriesCore(r)) {
+        switch (r.payload[0]) {
+            case SC_HORIZONTAL_MSG: return "HORIZONTAL";
+            case SC_VERTICAL_MSG: return "VERTICAL";
+            case SC_DIAL_MSG: return "DIAL";
+            case SC_ACK_MSG: return "ACK";
+            case SC_CANCEL_MSG: return "CANCEL";
+            default: return "OTHER";
+        }
+    }
+    switch (r.msgId) {
+        case SOLUTION_FOUND_MSG_ID: return "SOLUTION";
+        case SOLVER_VALUE_MSG_ID: return "SOLVER";
+        default: return "OTHER";
+    }
+}
+
+// Check sequence number of a core message, 0 for the others
+static unsigned seqOf(const SudokuTraceRecord &r) {
+    if (!carriesCore(r)) return 0;
+    uint8_t at = (r.payload[0] == SC_ACK_MSG) ? 4 : (r.payload[0] == SC_DIAL_MSG) ? 3 : 2;
+    return at < r.size ? r.payload[at] : 0;
+}
+
+static bool load(const char *path, vector<Event> &events) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "cannot open %s\n", path);
+        return false;
+    }
+    SudokuTraceHeader header;
+    if (fread(&header, sizeof(header), 1, f) != 1 || memcmp(header.magic, SUDOKU_TRACE_MAGIC, 4) != 0
+        || header.version != SUDOKU_TRACE_VERSION || header.recordSize != sizeof(SudokuTraceRecord)) {
+        fprintf(stderr, "%s is not a version %u sudoku trace\n", path, SUDOKU_TRACE_VERSION);
+        fclose(f);
+        return false;
+    }
+    Event e;
+    while (fread(&e.r, sizeof(e.r), 1, f) == 1) {
+        events.push_back(e);
+    }
+    fclose(f);
+    return true;
+}
+
+// Pair each receive with the oldest unmatched send of the same payload on the same link,
+// and each send with the receive its handler was running for (same block, same time)
+static void link(vector<Event> &events) {
+    map<tuple<uint32_t, uint32_t, string>, deque<size_t>> inFlight;
+    map<uint32_t, size_t> lastReceive;
+    for (size_t i = 0; i < events.size(); ++i) {
+        Event &e = events[i];
+        const SudokuTraceRecord &r = e.r;
+        if (r.event == TRACE_SEND) {
+            inFlight[make_tuple(r.blockId, r.peerId, string((const char*)r.payload, r.size))].push_back(i);
+            auto last = lastReceive.find(r.blockId);
+            if (last != lastReceive.end() && events[last->second].r.time == r.time) {
+                e.cause = last->second;
+            }
+        } else {
+            auto &queue = inFlight[make_tuple(r.peerId, r.blockId, string((const char*)r.payload, r.size))];
+            if (!queue.empty()) {
+                e.match = queue.front();
+                e.cause = queue.front();
+                events[queue.front()].match = i;
+                queue.pop_front();
+            }
+            lastReceive[r.blockId] = i;
+        }
+        e.root = (e.cause == NONE) ? i : events[e.cause].root;
+        e.depth = (e.cause == NONE) ? 0 : events[e.cause].depth + 1;
+    }
+}
+
+static void printEvent(const Event &e) {
+    const SudokuTraceRecord &r = e.r;
+    printf("  %10llu  block %-4u %s %-4u if %u  msg %u %-10s seq %u\n", (unsigned long long)r.time, r.blockId,
+           r.event == TRACE_SEND ? "->" : "<-", r.peerId, r.interface, r.msgId,
+           typeName(r), seqOf(r));
+}
+
+static void printTimelines(const vector<Event> &events) {
+    map<uint32_t, vector<size_t>> perBlock;
+    for (size_t i = 0; i < events.size(); ++i) {
+        perBlock[events[i].r.blockId].push_back(i);
+    }
+    for (auto &block : perBlock) {
+        printf("Block %u: %zu events\n", block.first, block.second.size());
+        for (size_t i : block.second) {
+            printEvent(events[i]);
+        }
+    }
+}
+
+// Sends issued by the handler of each received message, per message type
+static void printFanOut(const vector<Event> &events) {
+    vector<unsigned> sendsPerReceive(events.size(), 0);
+    for (const Event &e : events) {
+        if (e.r.event == TRACE_SEND && e.cause != NONE) {
+            sendsPerReceive[e.cause]++;
+        }
+    }
+    map<string, pair<unsigned, unsigned>> totals; // Type -> {receives, sends}
+    map<string, unsigned> maxima;
+    for (size_t i = 0; i < events.size(); ++i) {
+        if (events[i].r.event != TRACE_RECEIVE) continue;
+        string type = typeName(events[i].r);
+        totals[type].first++;
+        totals[type].second += sendsPerReceive[i];
+        maxima[type] = max(maxima[type], sendsPerReceive[i]);
+    }
+    printf("Fan-out (sends per received message):\n");
+    for (auto &t : totals) {
+        printf("  %-10s received %6u  mean %.2f  max %u\n", t.first.c_str(), t.second.first,
+               t.second.first ? (double)t.second.second / t.second.first : 0.0, maxima[t.first]);
+    }
+}
+
+// For each causal chain, the path to its last event is the critical path
+static void printCriticalPaths(const vector<Event> &events, size_t count) {
+    map<size_t, size_t> lastOfRoot;
+    for (size_t i = 0; i < events.size(); ++i) {
+        auto it = lastOfRoot.find(events[i].root);
+        if (it == lastOfRoot.end() || events[i].r.time >= events[it->second].r.time) {
+            lastOfRoot[events[i].root] = i;
+        }
+    }
+    vector<pair<uint64_t, size_t>> chains;
+    for (auto &c : lastOfRoot) {
+        chains.push_back(make_pair(events[c.second].r.time - events[c.first].r.time, c.second));
+    }
+    sort(chains.rbegin(), chains.rend());
+    printf("Critical paths (%zu causal chains):\n", chains.size());
+    for (size_t n = 0; n < chains.size() && n < count; ++n) {
+        vector<size_t> path;
+        for (size_t i = chains[n].second; i != NONE; i = events[i].cause) {
+            path.push_back(i);
+        }
+        printf(" #%zu: %llu us, %d hops, from block %u\n", n + 1, (unsigned long long)chains[n].first,
+               events[chains[n].second].depth, events[path.back()].r.blockId);
+        for (auto i = path.rbegin(); i != path.rend(); ++i) {
+            printEvent(events[*i]);
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <trace> [--timeline] [--paths N]\n", argv[0]);
+        return 1;
+    }
+    bool timeline = false;
+    size_t paths = 5;
+    for (int i = 2; i < argc; ++i) {
+        if (!strcmp(argv[i], "--timeline")) {
+            timeline = true;
+        } else if (!strcmp(argv[i], "--paths") && i + 1 < argc) {
+            paths = strtoul(argv[++i], nullptr, 10);
+        }
+    }
+
+    vector<Event> events;
+    if (!load(argv[1], events)) {
+        return 1;
+    }
+    link(events);
+
+    size_t sends = 0, unmatched = 0;
+    uint64_t latency = 0;
+    for (size_t i = 0; i < events.size(); ++i) {
+        if (events[i].r.event != TRACE_SEND) continue;
+        sends++;
+        if (events[i].match == NONE) {
+            unmatched++;
+        } else {
+            latency += events[events[i].match].r.time - events[i].r.time;
+        }
+    }
+    printf("%zu records, %zu sends, %zu never received, mean link latency %.1f us\n", events.size(), sends,
+           unmatched, sends > unmatched ? (double)latency / (sends - unmatched) : 0.0);
+
+    if (timeline) {
+        printTimelines(events);
+    }
+    printFanOut(events);
+    printCriticalPaths(events, paths);
+    return 0;
+}